@@ -0,0 +1,9 @@
+// Buffer cache statistics, as returned by bcachestat().
+struct bcachestat {
+  uint64 nbuf;        // buffers allocated now
+  uint64 maxbuf;      // most buffers the cache will allocate
+  uint64 hits;        // lookups that found the block cached
+  uint64 misses;      // lookups that did not
+  uint64 evictions;   // cached blocks dropped to reuse their buffers
+  uint64 shrinks;     // buffers given back to kalloc()
+};
@@ -12,6 +12,13 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Buffers are allocated a page at a time from kalloc(). A miss
+// grows the cache by a page while it is smaller than
+// 1/BCACHEFRAC of physical memory, and otherwise recycles the
+// least recently used unused buffer. When kalloc() runs out of
+// pages it calls bshrink(), which gives back pages whose
+// buffers are all unused, keeping at least NBUF buffers.
 
 
 #include "types.h"
@@ -22,34 +29,94 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "bcachestat.h"
+
+#define NBHASH 509
+#define BHASH(dev, blockno) (((dev) * 31 + (blockno)) % NBHASH)
+#define BPERPAGE ((int)(PGSIZE / sizeof(struct buf)))
+#define BSHRINK 16  // most pages bshrink() gives back at once
 
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *hash[NBHASH];
 
   // Linked list of all buffers, through prev/next.
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+
+  int nbuf;        // buffers allocated
+  int maxbuf;      // most buffers to allocate
+  struct bcachestat st;
 } bcache;
 
-void
-binit(void)
+static void
+bhash_remove(struct buf *b)
+{
+  if(b->hnext)
+    b->hnext->hpprev = b->hpprev;
+  *b->hpprev = b->hnext;
+  b->hpprev = 0;
+}
+
+static void
+bhash_insert(struct buf *b)
+{
+  struct buf **pp = &bcache.hash[BHASH(b->dev, b->blockno)];
+
+  b->hnext = *pp;
+  b->hpprev = pp;
+  if(*pp)
+    (*pp)->hpprev = &b->hnext;
+  *pp = b;
+}
+
+// Add a page of buffers at the least recently used end of
+// the list, to be used first. Caller must hold bcache.lock,
+// which is released while allocating the page.
+static int
+bgrow(void)
 {
   struct buf *b;
+  char *page;
+  int i;
 
+  release(&bcache.lock);
+  if((page = kalloc()) != 0){
+    memset(page, 0, PGSIZE);
+    for(i = 0; i < BPERPAGE; i++)
+      initsleeplock(&((struct buf*)page)[i].lock, "buffer");
+  }
+  acquire(&bcache.lock);
+  if(page == 0)
+    return -1;
+  for(i = 0; i < BPERPAGE; i++){
+    b = (struct buf*)page + i;
+    b->next = &bcache.head;
+    b->prev = bcache.head.prev;
+    bcache.head.prev->next = b;
+    bcache.head.prev = b;
+    bcache.nbuf++;
+  }
+  return 0;
+}
+
+void
+binit(void)
+{
   initlock(&bcache.lock, "bcache");
 
   // Create linked list of buffers
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
+  bcache.maxbuf = kpages() / BCACHEFRAC * BPERPAGE;
+  if(bcache.maxbuf < NBUF)
+    bcache.maxbuf = NBUF;
+  acquire(&bcache.lock);
+  while(bcache.nbuf < NBUF)
+    if(bgrow() < 0)
+      panic("binit");
+  release(&bcache.lock);
 }
 
 // Look through buffer cache for block on device dev.
@@ -59,27 +126,43 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  int grown;
 
   acquire(&bcache.lock);
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  for(grown = 0; ; grown = 1){
+    // Is the block already cached?
+    for(b = bcache.hash[BHASH(dev, blockno)]; b; b = b->hnext){
+      if(b->dev == dev && b->blockno == blockno){
+        b->refcnt++;
+        bcache.st.hits++;
+        release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
     }
+    // Not cached. Grow unless a buffer from the last bgrow()
+    // is still unused. bgrow() drops the lock, so look again
+    // afterwards in case someone else read the block.
+    b = bcache.head.prev;
+    if(grown || bcache.nbuf >= bcache.maxbuf || (b->refcnt == 0 && b->hpprev == 0))
+      break;
+    bgrow();
   }
+  bcache.st.misses++;
 
-  // Not cached.
   // Recycle the least recently used (LRU) unused buffer.
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
     if(b->refcnt == 0) {
+      if(b->hpprev){
+        bhash_remove(b);
+        bcache.st.evictions++;
+      }
       b->dev = dev;
       b->blockno = blockno;
       b->valid = 0;
       b->refcnt = 1;
+      bhash_insert(b);
       release(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
@@ -88,6 +171,67 @@ bget(uint dev, uint blockno)
   panic("bget: no buffers");
 }
 
+// Give pages whose buffers are all unused back to kalloc(),
+// least recently used first, keeping at least NBUF buffers.
+// Returns the number of pages given back.
+int
+bshrink(void)
+{
+  struct buf *b, *prev, *pb;
+  char *page, *list;
+  int i, n;
+
+  list = 0;
+  n = 0;
+  acquire(&bcache.lock);
+  for(b = bcache.head.prev; b != &bcache.head; b = prev){
+    prev = b->prev;
+    if(n == BSHRINK || bcache.nbuf - BPERPAGE < NBUF)
+      break;
+    if(b->refcnt != 0)
+      continue;
+    page = (char*)PGROUNDDOWN((uint64)b);
+    pb = (struct buf*)page;
+    for(i = 0; i < BPERPAGE; i++)
+      if(pb[i].refcnt != 0)
+        break;
+    if(i < BPERPAGE)
+      continue;
+    // don't let prev be one of the buffers going away.
+    while(prev != &bcache.head && PGROUNDDOWN((uint64)prev) == (uint64)page)
+      prev = prev->prev;
+    for(i = 0; i < BPERPAGE; i++){
+      pb[i].next->prev = pb[i].prev;
+      pb[i].prev->next = pb[i].next;
+      if(pb[i].hpprev)
+        bhash_remove(&pb[i]);
+      bcache.nbuf--;
+    }
+    bcache.st.shrinks += BPERPAGE;
+    *(char**)page = list;
+    list = page;
+    n++;
+  }
+  release(&bcache.lock);
+
+  while((page = list) != 0){
+    list = *(char**)page;
+    kfree(page);
+  }
+  return n;
+}
+
+// Copy out the cache's size and counters.
+void
+bstat(struct bcachestat *st)
+{
+  acquire(&bcache.lock);
+  *st = bcache.st;
+  st->nbuf = bcache.nbuf;
+  st->maxbuf = bcache.maxbuf;
+  release(&bcache.lock);
+}
+
 // Return a locked buf with the contents of the indicated block.
 struct buf*
 bread(uint dev, uint blockno)
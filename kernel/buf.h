@@ -7,6 +7,8 @@ struct buf {
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
+  struct buf *hnext;   // hash chain
+  struct buf **hpprev; // link that points to this buf, or 0
   uchar data[BSIZE];
 };
 
@@ -17,6 +17,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
+#include "poll.h"
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
@@ -50,6 +51,8 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+
+  struct pollhead pollers;  // poll()s waiting for input
 } cons;
 
 //
@@ -79,7 +82,7 @@ consolewrite(int user_src, uint64 src, int n)
 // or kernel address.
 //
 int
-consoleread(int user_dst, uint64 dst, int n)
+consoleread(int user_dst, uint64 dst, int n, uint off)
 {
   uint target;
   int c;
@@ -172,6 +175,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollnotify(&cons.pollers);
       }
     }
     break;
@@ -180,6 +184,24 @@ consoleintr(int c)
   release(&cons.lock);
 }
 
+// Input is ready once a whole line has arrived;
+// output never blocks for long.
+int
+consolepoll(int events, struct pollent *pe)
+{
+  int mask;
+
+  acquire(&cons.lock);
+  mask = POLLOUT;
+  if(cons.r != cons.w)
+    mask |= POLLIN;
+  mask &= events;
+  if(mask == 0 && pe)
+    pollwait(&cons.pollers, &cons.lock, pe);
+  release(&cons.lock);
+  return mask;
+}
+
 void
 consoleinit(void)
 {
@@ -191,4 +213,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
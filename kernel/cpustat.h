@@ -0,0 +1,7 @@
+// Per-CPU statistics, as returned by cpustat().
+struct cpustat {
+  uint64 timerintr;   // timer interrupts taken
+  uint64 nswtch;      // context switches into processes
+  uint64 idle;        // nanoseconds spent idle
+  uint64 nmigrate;    // processes switched to that last ran elsewhere
+};
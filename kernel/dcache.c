@@ -0,0 +1,178 @@
+//
+// Directory entry cache: remembers what dirlookup() found
+// for a name in a directory, including that it was absent,
+// so repeated lookups need not scan the directory.
+//
+// Entries are keyed on the directory's (dev, inum). Since
+// the directory's lock is held, shared or exclusive, both
+// when a lookup fills an entry and when dirlink() or unlink
+// changes one, an entry always agrees with the directory.
+// Freeing a directory forgets its entries, in case the
+// inode is reused for another, as does moving entries
+// when an indexed directory splits a block.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define NDHASH 127   // hash buckets; prime
+
+struct dentry {
+  uint dev;
+  uint dir;             // inode number of the directory
+  char name[DIRSIZ];
+  uint inum;            // 0 if the name is absent
+  uint off;             // offset of the dirent, if present
+  struct dentry *hnext; // hash chain
+  struct dentry *prev;  // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+  // head.next is most recent, head.prev least.
+  struct dentry head;
+} dcache;
+
+static uint
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + name[i];
+  return h % NDHASH;
+}
+
+void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    d->dir = 0;
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dhash(dev, dir, name)]; d; d = d->hnext)
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Take d off its hash chain and make it least recent.
+// Caller must hold dcache.lock.
+static void
+dforget(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(d->dev, d->dir, d->name)]; *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->dir = 0;
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = &dcache.head;
+  d->prev = dcache.head.prev;
+  dcache.head.prev->next = d;
+  dcache.head.prev = d;
+}
+
+// Make d most recent.
+static void
+dtouch(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.head.next;
+  d->prev = &dcache.head;
+  dcache.head.next->prev = d;
+  dcache.head.next = d;
+}
+
+// Look up name in directory dp. Returns 1 and sets *inum
+// (to 0 if name is known to be absent) and *poff if the
+// answer is cached, or 0 if it is not.
+// Caller must hold dp->lock.
+int
+dcache_lookup(struct inode *dp, char *name, uint *inum, uint *poff)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  dtouch(d);
+  *inum = d->inum;
+  *poff = d->off;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp refers to inum, at
+// offset off, or is absent if inum is 0.
+// Caller must hold dp->lock.
+void
+dcache_enter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  uint h;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    // recycle the least recently used entry.
+    d = dcache.head.prev;
+    if(d->dir)
+      dforget(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    h = dhash(d->dev, d->dir, d->name);
+    d->hnext = dcache.hash[h];
+    dcache.hash[h] = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  dtouch(d);
+  release(&dcache.lock);
+}
+
+// Forget every entry in directory dp, because it is being
+// freed or its entries have moved.
+void
+dcache_purge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++)
+    if(d->dir == dp->inum && d->dev == dp->dev)
+      dforget(d);
+  release(&dcache.lock);
+}
@@ -1,13 +1,19 @@
+struct bcachestat;
 struct buf;
 struct context;
 struct file;
 struct inode;
+struct lockstat;
+struct mm;
 struct pipe;
+struct pollent;
+struct pollhead;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct timer;
 
 // bio.c
 void            binit(void);
@@ -16,12 +22,20 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bshrink(void);
+void            bstat(struct bcachestat*);
 
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
 
+// dcache.c
+void            dcacheinit(void);
+int             dcache_lookup(struct inode*, char*, uint*, uint*);
+void            dcache_enter(struct inode*, char*, uint, uint);
+void            dcache_purge(struct inode*);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -33,17 +47,21 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filepoll(struct file*, int, struct pollent*);
+int             filesplice(struct file*, struct file*, int);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            ilockshared(struct inode*);
+void            iunlockshared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
@@ -52,6 +70,8 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             readipipe(struct inode*, struct pipe*, uint, uint);
+int             writeipipe(struct inode*, struct pipe*, uint, uint);
 void            itrunc(struct inode*);
 
 // ramdisk.c
@@ -63,10 +83,27 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+int             kpages(void);
+
+// futex.c
+void            futexinit(void);
+int             futex_wait(uint64, uint);
+int             futex_wake(uint64, int);
+
+// lockstat.c
+void            lockstatinit(void);
+struct lockstat* lockstat_register(char*, int);
+void            lockstat_acquired(struct lockstat*, int, uint64);
+void            lockstat_released(struct lockstat*, uint64);
+void            lockstat_waited(struct lockstat*, int);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
+void            log_free(uint);
+int             log_busy(uint);
+int             log_tid(void);
+void            log_force(int);
 void            begin_op(void);
 void            end_op(void);
 
@@ -75,6 +112,17 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipepoll(struct pipe*, int, int, struct pollent*);
+int             pipesetsize(struct pipe*, int);
+int             pipegetsize(struct pipe*);
+int             pipewait(struct pipe*, int);
+int             pipeput(struct pipe*, char*, int);
+int             pipeget(struct pipe*, char*, int);
+
+// poll.c
+void            pollwait(struct pollhead*, struct spinlock*, struct pollent*);
+void            pollnotify(struct pollhead*);
+int             poll(uint64, int, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -86,9 +134,17 @@ int             cpuid(void);
 void            exit(int);
 int             fork(void);
 int             growproc(int);
+struct mm*      mmalloc(void);
+void            mmput(struct mm*, uint64);
+void            tlbshootdown(struct mm*);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
+int             setaffinity(int, uint64);
+uint64          getaffinity(int);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+void            kthread(char*, void (*)(void));
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -100,6 +156,7 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeproc(struct proc*, void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -121,6 +178,8 @@ void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            acquiresleepshared(struct sleeplock*);
+void            releasesleepshared(struct sleeplock*);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -139,11 +198,20 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// timer.c
+void            tqinit(void);
+void            timer_program(void);
+void            timer_add(struct timer*);
+void            wheel_add(struct timer*);
+int             timer_del(struct timer*);
+int             timerfired(void);
+int             timerintr(void);
+int             timer_sleep(uint64);
+int             tick_sleep(int);
+
 // trap.c
-extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
 void            usertrapret(void);
 
 // uart.c
@@ -158,6 +226,9 @@ void            kvminit(void);
 void            kvminithart(void);
 uint64          kvmpa(uint64);
 void            kvmmap(uint64, uint64, uint64, int);
+uint64          kstackalloc(void);
+void            kstackfree(uint64);
+void            kstacksync(void);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
@@ -167,6 +238,7 @@ int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+pte_t*          walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
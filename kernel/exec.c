@@ -18,7 +18,9 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pagetable_t pagetable = 0, oldpagetable;
+  pagetable_t pagetable = 0;
+  struct mm *mm = 0, *oldmm;
+  uint64 oldtfva;
   struct proc *p = myproc();
 
   begin_op();
@@ -27,7 +29,7 @@ exec(char *path, char **argv)
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
 
   // Check ELF header
   if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -35,6 +37,8 @@ exec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
+  if((mm = mmalloc()) == 0)
+    goto bad;
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
@@ -57,12 +61,12 @@ exec(char *path, char **argv)
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
-  iunlockput(ip);
+  iunlockshared(ip);
+  iput(ip);
   end_op();
   ip = 0;
 
   p = myproc();
-  uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
@@ -108,21 +112,29 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
-  // Commit to the user image.
-  oldpagetable = p->pagetable;
+  // Commit to the user image, in a new address space;
+  // any other threads keep running in the old one.
+  mm->pagetable = pagetable;
+  mm->sz = sz;
+  oldmm = p->mm;
+  oldtfva = p->tfva;
+  p->mm = mm;
   p->pagetable = pagetable;
-  p->sz = sz;
+  p->tfva = TRAPFRAME;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  mmput(oldmm, oldtfva);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
   if(pagetable)
     proc_freepagetable(pagetable, sz);
+  if(mm)
+    kfree((void*)mm);
   if(ip){
-    iunlockput(ip);
+    iunlockshared(ip);
+    iput(ip);
     end_op();
   }
   return -1;
@@ -3,3 +3,7 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+// fcntl() commands
+#define F_GETPIPESZ 1  // size of a pipe's buffer
+#define F_SETPIPESZ 2  // resize a pipe's buffer
@@ -12,6 +12,14 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "poll.h"
+
+// Bytes of a file write per transaction. File data is not
+// logged (see writei()), so a write's log footprint is just
+// the i-node, the indirect block and the bitmap blocks, no
+// matter how long it is; the limit only keeps one write from
+// holding a transaction open for too long.
+#define MAXWRITE (16*BSIZE)
 
 struct devsw devsw[NDEV];
 struct {
@@ -91,9 +99,9 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, &st);
-    iunlock(f->ip);
+    iunlockshared(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
       return -1;
     return 0;
@@ -106,7 +114,7 @@ filestat(struct file *f, uint64 addr)
 int
 fileread(struct file *f, uint64 addr, int n)
 {
-  int r = 0;
+  int r = 0, shared;
 
   if(f->readable == 0)
     return -1;
@@ -116,12 +124,22 @@ fileread(struct file *f, uint64 addr, int n)
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    if((r = devsw[f->major].read(1, addr, n, f->off)) > 0)
+      f->off += r;
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
+    // f->off needs the exclusive lock if another descriptor
+    // holder could read through f at the same time.
+    shared = f->ref == 1;
+    if(shared)
+      ilockshared(f->ip);
+    else
+      ilock(f->ip);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
-    iunlock(f->ip);
+    if(shared)
+      iunlockshared(f->ip);
+    else
+      iunlock(f->ip);
   } else {
     panic("fileread");
   }
@@ -129,6 +147,29 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Return the requested events that are ready on f, plus any
+// POLLHUP or POLLERR. If none is, hook pe, if not 0, onto f's
+// pipe or device so that a change wakes pe's poll().
+int
+filepoll(struct file *f, int events, struct pollent *pe)
+{
+  int mask;
+
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->writable, events, pe);
+  if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV &&
+     devsw[f->major].poll)
+    return devsw[f->major].poll(events, pe);
+
+  // files and other devices never block.
+  mask = 0;
+  if(f->readable)
+    mask |= POLLIN;
+  if(f->writable)
+    mask |= POLLOUT;
+  return mask & events;
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
@@ -146,13 +187,9 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    // write MAXWRITE bytes at a time, each in its
+    // own transaction.
+    int max = MAXWRITE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
@@ -180,3 +217,124 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Move a file's data into a pipe from the buffer cache,
+// waiting for room, until n bytes or end of file.
+static int
+splicetopipe(struct file *in, struct pipe *pi, int n)
+{
+  int r, tot, eof;
+
+  for(tot = 0; tot < n; tot += r){
+    if(pipewait(pi, 1) < 0)
+      break;
+    ilock(in->ip);
+    if((r = readipipe(in->ip, pi, in->off, n - tot)) > 0)
+      in->off += r;
+    eof = in->off >= in->ip->size;
+    iunlock(in->ip);
+    if(r < 0)
+      break;
+    if(eof){
+      tot += r;
+      return tot;
+    }
+  }
+  return tot > 0 || n == 0 ? tot : -1;
+}
+
+// Move a pipe's data into a file's buffer cache blocks, once
+// the pipe has some, until n bytes or the pipe is empty.
+static int
+splicefrompipe(struct pipe *pi, struct file *out, int n)
+{
+  // a transaction's worth, as in filewrite().
+  int max = MAXWRITE;
+  int r, n1, tot;
+
+  r = 0;
+  if(n > 0 && (r = pipewait(pi, 0)) <= 0)
+    return r;
+  for(tot = 0; tot < n; tot += r){
+    n1 = n - tot;
+    if(n1 > max)
+      n1 = max;
+    begin_op();
+    ilock(out->ip);
+    if((r = writeipipe(out->ip, pi, out->off, n1)) > 0)
+      out->off += r;
+    iunlock(out->ip);
+    end_op();
+    if(r < 0)
+      break;
+    if(r < n1){
+      tot += r;
+      break;
+    }
+  }
+  return tot > 0 || r >= 0 ? tot : -1;
+}
+
+// Copy one file's data to another through a kernel page.
+// Neither inode is locked while the other is, so two
+// copies in opposite directions cannot deadlock.
+static int
+splicefile(struct file *in, struct file *out, int n)
+{
+  int max = PGSIZE;   // a bounce page at a time
+  int r, w, n1, tot;
+  char *buf;
+
+  if((buf = kalloc()) == 0)
+    return -1;
+  for(tot = 0; tot < n; tot += r){
+    n1 = n - tot;
+    if(n1 > max)
+      n1 = max;
+    ilock(in->ip);
+    if((r = readi(in->ip, 0, (uint64)buf, in->off, n1)) > 0)
+      in->off += r;
+    iunlock(in->ip);
+    if(r <= 0)
+      break;
+    begin_op();
+    ilock(out->ip);
+    if((w = writei(out->ip, 0, (uint64)buf, out->off, r)) > 0)
+      out->off += w;
+    iunlock(out->ip);
+    end_op();
+    if(w != r){
+      // put back the bytes that did not reach out.
+      if(w < 0)
+        w = 0;
+      ilock(in->ip);
+      in->off -= r - w;
+      iunlock(in->ip);
+      tot += w;
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+  }
+  kfree(buf);
+  return tot;
+}
+
+// Move up to n bytes from in to out without copying them
+// through user space, advancing the offset of either end
+// that is a file. One end must be a file and the other a
+// pipe or a file. Returns the number of bytes moved, 0 at
+// the end of in, or -1.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_INODE && out->type == FD_PIPE)
+    return splicetopipe(in, out->pipe, n);
+  if(in->type == FD_PIPE && out->type == FD_INODE)
+    return splicefrompipe(in->pipe, out, n);
+  if(in->type == FD_INODE && out->type == FD_INODE)
+    return splicefile(in, out, n);
+  return -1;
+}
+
@@ -5,7 +5,7 @@ struct file {
   char writable;
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
-  uint off;          // FD_INODE
+  uint off;          // FD_INODE and FD_DEVICE
   short major;       // FD_DEVICE
 };
 
@@ -18,6 +18,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;   // icache hash chain
+  struct inode *prev;    // icache free list, if ref is 0
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -27,14 +30,37 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+  uint goal;          // block balloc() should try first
+  int tid;            // log transaction of the last change
 };
 
 // map major device number to device functions.
+// A poll() waiting on a pipe or device, linked on the
+// object's pollhead. The object's lock protects the list.
+struct pollent {
+  struct poller *pt;      // the poll() call
+  struct spinlock *lk;    // lock of the object it is on, or 0
+  struct pollent *next;
+  struct pollent **pprev;
+};
+
+struct pollhead {
+  struct pollent *head;
+};
+
+// read is also passed the file offset, which fileread()
+// advances by the number of bytes read.
+// poll returns which of the requested poll.h events are
+// ready, and if none is, hooks the pollent, if any, onto
+// the device's pollhead with pollwait(). A device
+// without poll never blocks.
 struct devsw {
-  int (*read)(int, uint64, int);
+  int (*read)(int, uint64, int, uint);
   int (*write)(int, uint64, int);
+  int (*poll)(int, struct pollent*);
 };
 
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define LOCKSTAT 2
@@ -37,6 +37,9 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+static void bsuminit(int);
+static void isuminit(int);
+
 // Init fs
 void
 fsinit(int dev) {
@@ -44,6 +47,8 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bsuminit(dev);
+  isuminit(dev);
 }
 
 // Zero a block.
@@ -59,26 +64,121 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// balloc() keeps a count of the free blocks under each bitmap
+// block, so it need not read bitmap blocks that are full, and
+// skips full words of a bitmap block 32 bits at a time. It
+// starts looking at a goal block, the one after the block
+// the file got last, so a file's blocks come out contiguous
+// and appending to it finds a free block at once. Blocks
+// freed by the running transaction or still in the log are
+// passed over (see log.c).
+
+#define NBMAP (FSSIZE/BPB + 1)  // bitmap blocks
+
+struct {
+  struct spinlock lock;
+  int nfree[NBMAP];   // free blocks under each bitmap block
+} bsum;
+
+static int
+isfree(uchar *map, int bi)
+{
+  return (map[bi/8] & (1 << (bi % 8))) == 0;
+}
+
+// Count the free blocks under each bitmap block.
+static void
+bsuminit(int dev)
+{
+  struct buf *bp;
+  int b, bi, n;
+
+  initlock(&bsum.lock, "bsum");
+  if(sb.size > NBMAP*BPB)
+    panic("bsuminit: too many blocks");
+  // a file write logs at most the i-node, the indirect
+  // block, and the bitmap blocks; see filewrite().
+  if(NBMAP + 2 > MAXOPBLOCKS)
+    panic("bsuminit: too many bitmap blocks");
+  for(b = 0; b < sb.size; b += BPB){
+    bp = bread(dev, BBLOCK(b, sb));
+    n = 0;
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if(isfree(bp->data, bi))
+        n++;
+    brelse(bp);
+    bsum.nfree[b/BPB] = n;
+  }
+}
+
+// index of the lowest set bit in x, which must be non-zero.
+static int
+lowbit(uint x)
+{
+  int n = 0;
 
-// Allocate a zeroed disk block.
+  if((x & 0xffff) == 0){ n += 16; x >>= 16; }
+  if((x & 0xff) == 0){ n += 8; x >>= 8; }
+  if((x & 0xf) == 0){ n += 4; x >>= 4; }
+  if((x & 0x3) == 0){ n += 2; x >>= 2; }
+  if((x & 0x1) == 0){ n += 1; }
+  return n;
+}
+
+// The first clear bit of bitmap block map at or after
+// bit from and before bit lim, or -1.
+static int
+bitscan(uchar *map, int from, int lim)
+{
+  uint *w = (uint*)map;
+  uint x;
+  int i, bi;
+
+  for(i = from/32; i*32 < lim; i++){
+    x = ~w[i];
+    if(i == from/32)
+      x &= ~0U << (from % 32);
+    if(x == 0)
+      continue;
+    bi = i*32 + lowbit(x);
+    return bi < lim ? bi : -1;
+  }
+  return -1;
+}
+
+// Allocate a disk block, the first free one at or
+// after goal if there is one. The caller zeroes it.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
+  int i, n, b, bi, from, lim, nfree;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  if(goal >= sb.size)
+    goal = 0;
+  n = (sb.size + BPB - 1) / BPB;
+  // the last pass looks again at the start of goal's block.
+  for(i = 0; i <= n; i++){
+    b = (goal/BPB + i) % n * BPB;
+    acquire(&bsum.lock);
+    nfree = bsum.nfree[b/BPB];
+    release(&bsum.lock);
+    if(nfree == 0)
+      continue;
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+    from = i == 0 ? goal % BPB : 0;
+    lim = sb.size - b < BPB ? sb.size - b : BPB;
+    while((bi = bitscan(bp->data, from, lim)) >= 0 && log_busy(b + bi))
+      from = bi + 1;
+    if(bi >= 0){
+      bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      acquire(&bsum.lock);
+      bsum.nfree[b/BPB]--;
+      release(&bsum.lock);
+      return b + bi;
     }
     brelse(bp);
   }
@@ -100,6 +200,10 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  log_free(b);
+  acquire(&bsum.lock);
+  bsum.nfree[b/BPB]++;
+  release(&bsum.lock);
 }
 
 // Inodes.
@@ -127,18 +231,18 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() finds or creates a cache
+//   entry and increments its ref; iput() decrements ref.
+//   An entry whose ref is zero stays cached, on an LRU
+//   free list, until iget() recycles it for another inode.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
-//   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ilock() reads the inode from the disk and sets
+//   ip->valid, which stays set until iput() frees the
+//   inode or iget() recycles the entry.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -162,58 +266,186 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
+// The cache finds an entry by hashing (dev, inum), and
+// recycles the least recently released unreferenced entry.
+// It grows a page of entries at a time while it holds fewer
+// than NINODE, or when every entry is in use.
+//
 // The icache.lock spin-lock protects the allocation of icache
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// holds, one must hold icache.lock while using any of those
+// fields, the hash chains, and the free list.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum, and the links.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  // Unreferenced entries, most recently released
+  // first. head.next is most recent, head.prev least.
+  struct inode free;
+  int ninode;          // entries allocated
 } icache;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
+  icache.free.next = &icache.free;
+  icache.free.prev = &icache.free;
+}
+
+static void
+ifree_remove(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// Put ip at the recent end of the free list.
+static void
+ifree_insert(struct inode *ip)
+{
+  ip->next = icache.free.next;
+  ip->prev = &icache.free;
+  icache.free.next->prev = ip;
+  icache.free.next = ip;
+}
+
+// Add a page of entries to the free list.
+// Caller must hold icache.lock.
+static int
+igrow(void)
+{
+  struct inode *ip;
+  char *page;
+
+  if((page = kalloc()) == 0)
+    return -1;
+  memset(page, 0, PGSIZE);
+  for(ip = (struct inode*)page; ip + 1 <= (struct inode*)(page + PGSIZE); ip++){
+    initsleeplock(&ip->lock, "inode");
+    // at the least recent end, to be used first.
+    ip->next = &icache.free;
+    ip->prev = icache.free.prev;
+    icache.free.prev->next = ip;
+    icache.free.prev = ip;
+    icache.ninode++;
   }
+  return 0;
 }
 
 static struct inode* iget(uint dev, uint inum);
 
-// Allocate an inode on device dev.
+// The inode bitmap has a bit set for each allocated inode,
+// so ialloc() need not read inode blocks to find a free one.
+// Like balloc(), it keeps a count of free inodes under each
+// inode bitmap block.
+
+#define NIMAP 4   // inode bitmap blocks
+
+struct {
+  struct spinlock lock;
+  int nfree[NIMAP];   // free inodes under each inode bitmap block
+} isum;
+
+// Count the free inodes under each inode bitmap block.
+static void
+isuminit(int dev)
+{
+  struct buf *bp;
+  int i, bi, n;
+
+  initlock(&isum.lock, "isum");
+  if(sb.ninodes > NIMAP*BPB)
+    panic("isuminit: too many inodes");
+  for(i = 0; i < sb.ninodes; i += BPB){
+    bp = bread(dev, IMBLOCK(i, sb));
+    n = 0;
+    for(bi = 0; bi < BPB && i + bi < sb.ninodes; bi++)
+      if(isfree(bp->data, bi))
+        n++;
+    brelse(bp);
+    isum.nfree[i/BPB] = n;
+  }
+}
+
+// Allocate an inode on device dev, the first free one
+// at or after the start of inode near's block, so that
+// a directory's files share inode blocks with it.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint near)
 {
-  int inum;
+  int i, n, b, bi, from, lim, nfree;
+  uint goal;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
+  goal = near - near % IPB;
+  if(goal >= sb.ninodes)
+    goal = 0;
+  n = (sb.ninodes + BPB - 1) / BPB;
+  for(i = 0; i <= n; i++){
+    b = (goal/BPB + i) % n * BPB;
+    acquire(&isum.lock);
+    nfree = isum.nfree[b/BPB];
+    release(&isum.lock);
+    if(nfree == 0)
+      continue;
+    bp = bread(dev, IMBLOCK(b, sb));
+    from = i == 0 ? goal % BPB : 0;
+    lim = sb.ninodes - b < BPB ? sb.ninodes - b : BPB;
+    if((bi = bitscan(bp->data, from, lim)) >= 0){
+      bp->data[bi/8] |= 1 << (bi % 8);
+      log_write(bp);
+      brelse(bp);
+      acquire(&isum.lock);
+      isum.nfree[b/BPB]--;
+      release(&isum.lock);
+
+      bp = bread(dev, IBLOCK(b + bi, sb));
+      dip = (struct dinode*)bp->data + (b + bi)%IPB;
+      if(dip->type != 0)
+        panic("ialloc: inode in use");
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
-      return iget(dev, inum);
+      return iget(dev, b + bi);
     }
     brelse(bp);
   }
   panic("ialloc: no inodes");
 }
 
+// Mark inode inum free in the inode bitmap.
+static void
+ifree(int dev, uint inum)
+{
+  struct buf *bp;
+  int bi, m;
+
+  bp = bread(dev, IMBLOCK(inum, sb));
+  bi = inum % BPB;
+  m = 1 << (bi % 8);
+  if((bp->data[bi/8] & m) == 0)
+    panic("freeing free inode");
+  bp->data[bi/8] &= ~m;
+  log_write(bp);
+  brelse(bp);
+  acquire(&isum.lock);
+  isum.nfree[inum/BPB]++;
+  release(&isum.lock);
+}
+
 // Copy a modified in-memory inode to disk.
 // Must be called after every change to an ip->xxx field
 // that lives on disk, since i-node cache is write-through.
@@ -234,6 +466,7 @@ iupdate(struct inode *ip)
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
+  ip->tid = log_tid();
 }
 
 // Find the inode with number inum on device dev
@@ -242,31 +475,38 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        ifree_remove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Recycle the least recently used free entry.
+  if(icache.ninode < NINODE || icache.free.prev == &icache.free)
+    if(igrow() < 0 && icache.free.prev == &icache.free)
+      panic("iget: no inodes");
+  ip = icache.free.prev;
+  ifree_remove(ip);
+  if(ip->inum){
+    for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = icache.hash[IHASH(dev, inum)];
+  icache.hash[IHASH(dev, inum)] = ip;
   release(&icache.lock);
 
   return ip;
@@ -306,6 +546,9 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->goal = 0;
+    // its last change may not have committed yet.
+    ip->tid = log_tid();
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -322,6 +565,33 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Lock the given inode shared, for callers that only read
+// it or its contents, such as lookups and readi().
+// Reads the inode from disk if necessary.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  // only an exclusive holder may fill in the inode.
+  // it stays valid while we hold a reference.
+  if(ip->valid == 0){
+    ilock(ip);
+    iunlock(ip);
+  }
+  acquiresleepshared(&ip->lock);
+}
+
+void
+iunlockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlockshared");
+
+  releasesleepshared(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
 // be recycled.
@@ -343,9 +613,12 @@ iput(struct inode *ip)
 
     release(&icache.lock);
 
+    if(ip->type == T_DIR)
+      dcache_purge(ip);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
+    ifree(ip->dev, ip->inum);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
@@ -353,7 +626,8 @@ iput(struct inode *ip)
     acquire(&icache.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0)
+    ifree_insert(ip);
   release(&icache.lock);
 }
 
@@ -372,6 +646,22 @@ iunlockput(struct inode *ip)
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
 // listed in block ip->addrs[NDIRECT].
 
+// Allocate a block for ip at its goal, and make the
+// block after it the next goal. Indirect and directory
+// blocks are zeroed through the log; writei() zeroes a
+// file's data blocks as it fills them (see iblock()).
+static uint
+iballoc(struct inode *ip, int data)
+{
+  uint b;
+
+  b = balloc(ip->dev, ip->goal);
+  ip->goal = b + 1;
+  if(!data || ip->type != T_FILE)
+    bzero(ip->dev, b);
+  return b;
+}
+
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
@@ -381,8 +671,11 @@ bmap(struct inode *ip, uint bn)
   struct buf *bp;
 
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+    if((addr = ip->addrs[bn]) == 0){
+      if(bn > 0 && ip->addrs[bn-1])
+        ip->goal = ip->addrs[bn-1] + 1;
+      ip->addrs[bn] = addr = iballoc(ip, 1);
+    }
     return addr;
   }
   bn -= NDIRECT;
@@ -390,11 +683,13 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = iballoc(ip, 0);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+      if(bn > 0 && a[bn-1])
+        ip->goal = a[bn-1] + 1;
+      a[bn] = addr = iballoc(ip, 1);
       log_write(bp);
     }
     brelse(bp);
@@ -475,6 +770,33 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Return a locked buffer holding block bn of ip, to be
+// written. A file data block at or past the end of the file
+// was never zeroed by iballoc(), so zero it in the cache.
+static struct buf*
+iblock(struct inode *ip, uint bn)
+{
+  struct buf *bp;
+
+  bp = bread(ip->dev, bmap(ip, bn));
+  if(ip->type == T_FILE && bn*BSIZE >= ip->size)
+    memset(bp->data, 0, BSIZE);
+  return bp;
+}
+
+// Write back a block of ip's contents. A file's data goes
+// straight home, so it is on disk before the transaction
+// that adds it to the file commits; everything else is
+// logged.
+static void
+iwrite(struct inode *ip, struct buf *bp)
+{
+  if(ip->type == T_FILE)
+    bwrite(bp);
+  else
+    log_write(bp);
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -491,13 +813,13 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bp = iblock(ip, off/BSIZE);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
-    log_write(bp);
+    iwrite(ip, bp);
     brelse(bp);
   }
 
@@ -513,7 +835,96 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   return n;
 }
 
+// Move up to n bytes at offset off of ip into pipe pi,
+// straight from the buffer cache, until pi is full.
+// Caller must hold ip->lock.
+// Returns the number moved, or -1 if pi's reader is gone.
+int
+readipipe(struct inode *ip, struct pipe *pi, uint off, uint n)
+{
+  uint tot, m;
+  int r;
+  struct buf *bp;
+
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; tot+=r, off+=r){
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    m = min(n - tot, BSIZE - off%BSIZE);
+    r = pipeput(pi, (char*)bp->data + (off % BSIZE), m);
+    brelse(bp);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    if(r < m){
+      tot += r;
+      break;
+    }
+  }
+  return tot;
+}
+
+// Move up to n bytes from pipe pi into ip at offset off,
+// straight into the buffer cache, until pi is empty.
+// Caller must hold ip->lock and be in a transaction.
+// Returns the number moved, or -1.
+int
+writeipipe(struct inode *ip, struct pipe *pi, uint off, uint n)
+{
+  uint tot, m;
+  int r;
+  struct buf *bp;
+
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > MAXFILE*BSIZE)
+    return -1;
+
+  for(tot=0; tot<n; tot+=r, off+=r){
+    bp = iblock(ip, off/BSIZE);
+    m = min(n - tot, BSIZE - off%BSIZE);
+    r = pipeget(pi, (char*)bp->data + (off % BSIZE), m);
+    if(r > 0)
+      iwrite(ip, bp);
+    brelse(bp);
+    if(r < m){
+      tot += r;
+      off += r;
+      break;
+    }
+  }
+
+  if(n > 0){
+    if(off > ip->size)
+      ip->size = off;
+    // bmap() may have added a block even if nothing moved.
+    iupdate(ip);
+  }
+  return tot;
+}
+
 // Directories
+//
+// A directory starts as a plain array of dirents. When its
+// first block is full, dirlink() makes it an indexed
+// directory: a hash tree of one or two levels, like ext3's
+// htree, that finds a name's block from its dirhash().
+//
+// Block 0 of an indexed directory keeps "." and "..", then
+// a dxhead and an array of dxents sorted by hash. With depth
+// 0 each dxent names the leaf block holding the names that
+// hash from its hash up to the next dxent's; with depth 1 it
+// names an index block, itself a dxhead and dxents, that
+// names leaves. Leaves are plain arrays of dirents. A full
+// leaf splits, moving its upper half of hashes to a new
+// block; a full index block splits the same way, and a full
+// block 0 moves its entries to a new index block below it.
+// Unlinking a name just clears its dirent, as before.
+//
+// mkfs builds the root directory indexed. Directories whose
+// block 0 lacks the dxhead are searched linearly.
 
 int
 namecmp(const char *s, const char *t)
@@ -521,39 +932,406 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+#define NDIRBATCH 16  // dirents dirscan() reads at once
+
+// Look for name in the dirents of dp between byte offsets
+// off and end. If found, set *pinum and *poff and return 1.
+static int
+dirscan(struct inode *dp, char *name, uint off, uint end, uint *pinum, uint *poff)
+{
+  struct dirent de[NDIRBATCH];
+  uint n;
+  int i;
+
+  for(; off < end; off += n){
+    n = end - off;
+    if(n > sizeof(de))
+      n = sizeof(de);
+    if(readi(dp, 0, (uint64)de, off, n) != n)
+      panic("dirlookup read");
+    for(i = 0; i < n / sizeof(de[0]); i++){
+      if(de[i].inum == 0)
+        continue;
+      if(namecmp(name, de[i].name) == 0){
+        *pinum = de[i].inum;
+        *poff = off + i * sizeof(de[0]);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// The way from block 0 to the leaf for a hash.
+struct dxpath {
+  int depth;
+  int ri;          // dxent in block 0
+  uint iblock;     // index block, if depth is 1
+  int ii;          // dxent in the index block
+  uint leaf;
+};
+
+// The dxhead of an index block, or of block 0 if root,
+// or 0 if it has none.
+static struct dxhead*
+dxhead(struct buf *bp, int root)
+{
+  struct dxhead *h;
+
+  h = (struct dxhead*)((struct dirent*)bp->data + (root ? 2 : 0));
+  if(h->inum != 0 || h->magic != DXMAGIC)
+    return 0;
+  return h;
+}
+
+static struct dxent*
+dxents(struct dxhead *h)
+{
+  return (struct dxent*)(h + 1);
+}
+
+// The last of h's dxents whose hash is at most hash.
+static int
+dxsearch(struct dxhead *h, uint hash)
+{
+  struct dxent *e = dxents(h);
+  int lo, hi, mid;
+
+  // the first dxent's hash is no more than any
+  // hash whose search has led to this block.
+  lo = 0;
+  hi = h->count - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(e[mid].hash <= hash)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+// Insert (hash, block) as h's dxent number i.
+static void
+dxput(struct dxhead *h, int i, uint hash, uint block)
+{
+  struct dxent *e = dxents(h);
+
+  memmove(e + i + 1, e + i, (h->count - i) * sizeof(*e));
+  memset(e + i, 0, sizeof(*e));
+  e[i].hash = hash;
+  e[i].block = block;
+  h->count++;
+}
+
+// Find the leaf of dp for hash.
+// Returns -1 if dp is not indexed.
+// Caller must hold dp->lock.
+static int
+dxfind(struct inode *dp, uint hash, struct dxpath *pa)
+{
+  struct buf *bp;
+  struct dxhead *h;
+
+  if(dp->size < 2*BSIZE)
+    return -1;
+  bp = bread(dp->dev, bmap(dp, 0));
+  if((h = dxhead(bp, 1)) == 0){
+    brelse(bp);
+    return -1;
+  }
+  pa->depth = h->depth;
+  pa->ri = dxsearch(h, hash);
+  pa->leaf = dxents(h)[pa->ri].block;
+  brelse(bp);
+  if(pa->depth > 0){
+    pa->iblock = pa->leaf;
+    bp = bread(dp->dev, bmap(dp, pa->iblock));
+    if((h = dxhead(bp, 0)) == 0)
+      panic("dxfind");
+    pa->ii = dxsearch(h, hash);
+    pa->leaf = dxents(h)[pa->ii].block;
+    brelse(bp);
+  }
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Remembers the answer in the dentry cache.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
-  struct dirent de;
+  struct dxpath pa;
+  int found;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  if(dcache_lookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0 ||
+     dxfind(dp, dirhash(name), &pa) < 0)
+    found = dirscan(dp, name, 0, dp->size, &inum, &off);
+  else
+    found = dirscan(dp, name, pa.leaf*BSIZE, (pa.leaf+1)*BSIZE, &inum, &off);
+
+  if(!found){
+    dcache_enter(dp, name, 0, 0);
+    return 0;
+  }
+  // entry matches path element
+  if(poff)
+    *poff = off;
+  dcache_enter(dp, name, inum, off);
+  return iget(dp->dev, inum);
+}
+
+// Index of a free dirent in a leaf, or -1.
+static int
+dxfree(struct buf *bp)
+{
+  struct dirent *de = (struct dirent*)bp->data;
+  int i;
+
+  for(i = 0; i < DPB; i++)
+    if(de[i].inum == 0)
+      return i;
+  return -1;
+}
+
+// Move the names in full leaf bp whose hashes are in the
+// upper half to the empty block nbp. Returns the lowest
+// hash moved, or 0 if all the names have the same hash.
+static uint
+dxsplit(struct buf *bp, struct buf *nbp)
+{
+  struct dirent *de = (struct dirent*)bp->data;
+  struct dirent *nde = (struct dirent*)nbp->data;
+  uint h[DPB], x, split;
+  int i, j;
+
+  for(i = 0; i < DPB; i++){
+    x = dirhash(de[i].name);
+    for(j = i; j > 0 && h[j-1] > x; j--)
+      h[j] = h[j-1];
+    h[j] = x;
+  }
+  split = h[DPB/2];
+  for(i = DPB/2; i > 0 && h[i-1] == split; i--)
+    ;
+  if(i == 0){
+    // the lower half all hashes to split.
+    for(i = DPB/2; i < DPB && h[i] == split; i++)
+      ;
+    if(i == DPB)
+      return 0;
+    split = h[i];
+  }
+
+  for(i = j = 0; i < DPB; i++){
+    if(dirhash(de[i].name) >= split){
+      nde[j++] = de[i];
+      memset(&de[i], 0, sizeof(de[i]));
+    }
+  }
+  return split;
+}
+
+// Can dp's index take a dxent for one more leaf?
+static int
+dxroom(struct inode *dp, struct dxpath *pa)
+{
+  struct buf *bp;
+  int full;
+
+  // a new leaf, and perhaps a new index block.
+  if(dp->size/BSIZE + 2 > MAXFILE)
+    return 0;
+  if(pa->depth == 0)
+    return 1;
+  bp = bread(dp->dev, bmap(dp, pa->iblock));
+  full = dxhead(bp, 0)->count == DXMAX;
+  brelse(bp);
+  if(!full)
+    return 1;
+  bp = bread(dp->dev, bmap(dp, 0));
+  full = dxhead(bp, 1)->count == DXROOTMAX;
+  brelse(bp);
+  return !full;
+}
+
+// Add block to dp's index, for hashes from hash, after the
+// dxent that pa followed to the leaf it was split from.
+//
+// This is the costliest path through the log: a mkdir whose
+// name splits a leaf and then an index block writes the two
+// leaves, the two index blocks, block 0, the directory's
+// indirect block and i-node, the new directory's block and
+// i-node, the block bitmap and the inode bitmap, 11 blocks in
+// all. MAXOPBLOCKS leaves one more for allocations that span
+// two block bitmap blocks.
+static void
+dxinsert(struct inode *dp, struct dxpath *pa, uint hash, uint block)
+{
+  struct buf *rbp, *ibp, *nbp;
+  struct dxhead *rh, *ih, *nh;
+  uint nb;
+  int half;
+
+  rbp = bread(dp->dev, bmap(dp, 0));
+  rh = dxhead(rbp, 1);
+  if(rh->depth == 0){
+    if(rh->count < DXROOTMAX){
+      dxput(rh, pa->ri + 1, hash, block);
+      log_write(rbp);
+      brelse(rbp);
+      return;
     }
+    // block 0 is full: move its dxents to an index block.
+    nb = dp->size / BSIZE;
+    ibp = bread(dp->dev, bmap(dp, nb));
+    ih = (struct dxhead*)ibp->data;
+    ih->magic = DXMAGIC;
+    ih->count = rh->count;
+    memmove(dxents(ih), dxents(rh), rh->count * sizeof(struct dxent));
+    memset(dxents(rh), 0, rh->count * sizeof(struct dxent));
+    rh->depth = 1;
+    rh->count = 0;
+    dxput(rh, 0, 0, nb);
+    dp->size += BSIZE;
+    iupdate(dp);
+    pa->iblock = nb;
+    pa->ii = pa->ri;
+    pa->ri = 0;
+  } else {
+    ibp = bread(dp->dev, bmap(dp, pa->iblock));
+    ih = dxhead(ibp, 0);
   }
 
+  if(ih->count == DXMAX){
+    // move the index block's upper half to a new one.
+    nb = dp->size / BSIZE;
+    nbp = bread(dp->dev, bmap(dp, nb));
+    nh = (struct dxhead*)nbp->data;
+    nh->magic = DXMAGIC;
+    half = ih->count / 2;
+    nh->count = ih->count - half;
+    memmove(dxents(nh), dxents(ih) + half, nh->count * sizeof(struct dxent));
+    memset(dxents(ih) + half, 0, nh->count * sizeof(struct dxent));
+    ih->count = half;
+    dxput(rh, pa->ri + 1, dxents(nh)[0].hash, nb);
+    dp->size += BSIZE;
+    iupdate(dp);
+    if(pa->ii >= half){
+      pa->ii -= half;
+      log_write(ibp);
+      brelse(ibp);
+      ibp = nbp;
+      ih = nh;
+    } else {
+      log_write(nbp);
+      brelse(nbp);
+    }
+  }
+  dxput(ih, pa->ii + 1, hash, block);
+  log_write(ibp);
+  brelse(ibp);
+  log_write(rbp);
+  brelse(rbp);
+}
+
+// Write (name, inum) into a leaf of indexed directory dp,
+// splitting the leaf if it is full.
+// Returns 0, -1 if the index is full, or 1 if dp is not
+// indexed.
+static int
+dxlink(struct inode *dp, char *name, uint inum)
+{
+  struct dxpath pa;
+  struct buf *bp, *nbp;
+  struct dirent *de;
+  uint hash, split, nb;
+  int i;
+
+  hash = dirhash(name);
+  if(dxfind(dp, hash, &pa) < 0)
+    return 1;
+  bp = bread(dp->dev, bmap(dp, pa.leaf));
+  if((i = dxfree(bp)) < 0){
+    if(!dxroom(dp, &pa)){
+      brelse(bp);
+      return -1;
+    }
+    nb = dp->size / BSIZE;
+    nbp = bread(dp->dev, bmap(dp, nb));
+    if((split = dxsplit(bp, nbp)) == 0){
+      brelse(nbp);
+      brelse(bp);
+      iupdate(dp);  // bmap() added nb
+      return -1;
+    }
+    log_write(bp);
+    log_write(nbp);
+    brelse(nbp);
+    brelse(bp);
+    dp->size += BSIZE;
+    iupdate(dp);
+    dxinsert(dp, &pa, split, nb);
+    // names moved, so their cached offsets are stale.
+    dcache_purge(dp);
+    if(hash >= split)
+      pa.leaf = nb;
+    bp = bread(dp->dev, bmap(dp, pa.leaf));
+    i = dxfree(bp);
+  }
+  de = (struct dirent*)bp->data + i;
+  strncpy(de->name, name, DIRSIZ);
+  de->inum = inum;
+  log_write(bp);
+  brelse(bp);
+  dcache_enter(dp, name, inum, pa.leaf*BSIZE + i*sizeof(*de));
   return 0;
 }
 
+// Make dp, whose single block is full, an indexed directory
+// whose one leaf holds everything but "." and "..".
+static void
+dxconvert(struct inode *dp)
+{
+  struct buf *bp, *nbp;
+  struct dxhead *h;
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  nbp = bread(dp->dev, bmap(dp, 1));
+  memmove(nbp->data, (struct dirent*)bp->data + 2, (DPB-2) * sizeof(struct dirent));
+  memset((struct dirent*)bp->data + 2, 0, (DPB-2) * sizeof(struct dirent));
+  h = (struct dxhead*)((struct dirent*)bp->data + 2);
+  h->magic = DXMAGIC;
+  h->depth = 0;
+  h->count = 0;
+  dxput(h, 0, 0, 1);
+  log_write(nbp);
+  brelse(nbp);
+  log_write(bp);
+  brelse(bp);
+  dp->size = 2*BSIZE;
+  iupdate(dp);
+  dcache_purge(dp);
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  int off, r;
   struct dirent de;
   struct inode *ip;
 
@@ -563,6 +1341,9 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if((r = dxlink(dp, name, inum)) <= 0)
+    return r;
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -571,10 +1352,17 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  // Index a directory rather than grow it past one block.
+  if(off == BSIZE && dp->size == BSIZE){
+    dxconvert(dp);
+    return dxlink(dp, name, inum);
+  }
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcache_enter(dp, name, inum, off);
 
   return 0;
 }
@@ -633,21 +1421,24 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    // lookups only read the directory, so they can
+    // share it with lookups by other processes.
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlockshared(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+    next = dirlookup(ip, name, 0);
+    iunlockshared(ip);
+    iput(ip);
+    if(next == 0)
       return 0;
-    }
-    iunlockput(ip);
     ip = next;
   }
   if(nameiparent){
@@ -7,7 +7,7 @@
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                      inode bit map | free bit map | data blocks]
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -20,6 +20,7 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint imapstart;    // Block number of first inode map block
 };
 
 #define FSMAGIC 0x10203040
@@ -50,6 +51,9 @@ struct dinode {
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
+// Block of inode map containing bit for inode i
+#define IMBLOCK(i, sb) ((i)/BPB + sb.imapstart)
+
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
@@ -58,3 +62,45 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+
+#define DPB (BSIZE / sizeof(struct dirent))  // dirents per block
+
+// An indexed directory is a hash tree of its names, like
+// ext3's htree; see fs.c. Its index records each fill a
+// dirent slot and have inum 0, so code that reads the
+// directory as dirents skips them.
+#define DXMAGIC 0x68747265
+
+// Starts block 0, after "." and "..", and each index block.
+struct dxhead {
+  ushort inum;     // always 0
+  ushort count;    // dxents that follow
+  uint magic;      // DXMAGIC
+  uint depth;      // in block 0: levels of index blocks below
+  uint unused;
+};
+
+// Names hashing from hash up to the next dxent's hash
+// are under block.
+struct dxent {
+  ushort inum;     // always 0
+  ushort block;    // directory block number
+  uint hash;
+  uint unused[2];
+};
+
+#define DXROOTMAX (DPB - 3)   // dxents in block 0
+#define DXMAX     (DPB - 1)   // dxents in an index block
+
+// Hash of a name in an indexed directory.
+static inline uint
+dirhash(const char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261U;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619U;
+  return h;
+}
@@ -0,0 +1,125 @@
+//
+// Futexes: sleep until another thread wakes a user address.
+//
+// Waiters are queued in a hash table keyed on the physical
+// address of the futex word, so threads sharing an address
+// space agree on the key whatever else happens to the page
+// tables. A bucket's lock is held while futex_wait() checks
+// the word and queues itself, so a futex_wake() that follows
+// a change to the word cannot be missed.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NFUTEX 61   // hash buckets; prime
+
+struct fwaiter {
+  uint64 pa;              // physical address of the futex word
+  struct proc *p;
+  int woken;
+  struct fwaiter *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct fwaiter *head;
+} futexq[NFUTEX];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEX; i++)
+    initlock(&futexq[i].lock, "futex");
+}
+
+// Physical address of the aligned 32-bit word at user
+// address uaddr, or 0 if it is not mapped.
+static uint64
+futexaddr(uint64 uaddr)
+{
+  uint64 pa;
+
+  if(uaddr % sizeof(uint32) != 0)
+    return 0;
+  if((pa = walkaddr(myproc()->pagetable, PGROUNDDOWN(uaddr))) == 0)
+    return 0;
+  return pa + uaddr % PGSIZE;
+}
+
+// If the word at uaddr still holds val, sleep until
+// futex_wake() is called for it.
+// Returns 0 if woken, -1 if the word did not hold val,
+// uaddr was bad, or the thread was killed.
+int
+futex_wait(uint64 uaddr, uint val)
+{
+  struct fwaiter w, **pp;
+  struct proc *p = myproc();
+  uint32 cur;
+  int b;
+
+  if((w.pa = futexaddr(uaddr)) == 0)
+    return -1;
+  w.p = p;
+  w.woken = 0;
+  b = w.pa % NFUTEX;
+
+  acquire(&futexq[b].lock);
+  // through copyin(), since another thread may
+  // have unmapped and freed the page since.
+  if(copyin(p->pagetable, (char*)&cur, uaddr, sizeof(cur)) < 0 || cur != val){
+    release(&futexq[b].lock);
+    return -1;
+  }
+  w.next = futexq[b].head;
+  futexq[b].head = &w;
+  while(!w.woken){
+    if(p->killed){
+      for(pp = &futexq[b].head; *pp != &w; pp = &(*pp)->next)
+        ;
+      *pp = w.next;
+      release(&futexq[b].lock);
+      return -1;
+    }
+    sleep(&w, &futexq[b].lock);
+  }
+  release(&futexq[b].lock);
+  return 0;
+}
+
+// Wake up to n threads waiting on the word at uaddr.
+// Returns the number woken, or -1 if uaddr is bad.
+int
+futex_wake(uint64 uaddr, int n)
+{
+  struct fwaiter *w, **pp;
+  uint64 pa;
+  int b, woken;
+
+  if((pa = futexaddr(uaddr)) == 0)
+    return -1;
+  b = pa % NFUTEX;
+
+  woken = 0;
+  acquire(&futexq[b].lock);
+  for(pp = &futexq[b].head; (w = *pp) != 0 && woken < n; ){
+    if(w->pa != pa){
+      pp = &w->next;
+      continue;
+    }
+    *pp = w->next;
+    w->woken = 1;
+    wakeproc(w->p, w);
+    woken++;
+  }
+  release(&futexq[b].lock);
+  return woken;
+}
@@ -21,6 +21,7 @@ struct run {
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int npage;     // pages given to the allocator by kinit()
 } kmem;
 
 void
@@ -35,8 +36,17 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
     kfree(p);
+    kmem.npage++;
+  }
+}
+
+// The number of pages of physical memory the allocator manages.
+int
+kpages(void)
+{
+  return kmem.npage;
 }
 
 // Free the page of physical memory pointed at by v,
@@ -65,16 +75,22 @@ kfree(void *pa)
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When no page is free, takes pages back from the buffer
+// cache, so the caller must not hold bcache.lock.
 void *
 kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  for(;;){
+    acquire(&kmem.lock);
+    r = kmem.freelist;
+    if(r)
+      kmem.freelist = r->next;
+    release(&kmem.lock);
+    if(r || bshrink() == 0)
+      break;
+  }
 
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
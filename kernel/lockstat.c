@@ -0,0 +1,172 @@
+//
+// Lock contention statistics.
+//
+// initlock() and initsleeplock() register each lock with the
+// record for its name, and acquire()/release() and their
+// sleeplock counterparts count into it using the cycle CSR.
+// Each CPU counts into its own copy of the records, so that
+// locks of one class held on several CPUs do not share a
+// cache line; lockstatread() sums the copies. The records
+// are read as an array of struct lockstat from the lockstat
+// device.
+//
+// Every lock name is a string constant, so the record for a
+// name is cached by its address, and locks made on hot paths
+// (procs, pipes, buffers, poll()) find it without lslock.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "fs.h"
+#include "file.h"
+#include "lockstat.h"
+#include "defs.h"
+
+#define NLOCKSTAT 64
+#define NLSCACHE  127  // prime
+
+// not initialized with initlock(), which calls lockstat_register().
+static struct spinlock lslock = { .name = "lockstat" };
+// name and type are set only in stats[0].
+static struct lockstat stats[NCPU][NLOCKSTAT];
+static int nstats;
+
+// Records by name address, one table per type. An entry
+// is filled in once, under lslock, and never changes, so
+// it can be read without lslock once its name is set.
+static struct {
+  char *name;
+  struct lockstat *st;
+} lscache[2][NLSCACHE];
+
+// Return the record for locks named name,
+// or 0 if the table is full.
+struct lockstat*
+lockstat_register(char *name, int type)
+{
+  struct lockstat *st;
+  int h = (uint64)name % NLSCACHE;
+
+  if(*(char * volatile *)&lscache[type-1][h].name == name){
+    __sync_synchronize();
+    return lscache[type-1][h].st;
+  }
+
+  acquire(&lslock);
+  for(st = stats[0]; st < &stats[0][nstats]; st++)
+    if(st->type == type && strncmp(st->name, name, sizeof(st->name)) == 0)
+      break;
+  if(st == &stats[0][nstats]){
+    if(nstats < NLOCKSTAT){
+      safestrcpy(st->name, name, sizeof(st->name));
+      st->type = type;
+      // publish the record only once it is filled in.
+      __sync_synchronize();
+      nstats++;
+    } else {
+      st = 0;
+    }
+  }
+  if(st && lscache[type-1][h].name == 0){
+    lscache[type-1][h].st = st;
+    __sync_synchronize();
+    lscache[type-1][h].name = name;
+  }
+  release(&lslock);
+  return st;
+}
+
+// This CPU's copy of record st. Sleeplock waiters count
+// with interrupts on, so the callers turn them off to stay
+// on one CPU while they update it.
+static struct lockstat*
+mystat(struct lockstat *st)
+{
+  return &stats[cpuid()][st - stats[0]];
+}
+
+// Count an acquisition of a lock with record st
+// that waited wait cycles, if it was contended.
+void
+lockstat_acquired(struct lockstat *st, int contended, uint64 wait)
+{
+  push_off();
+  st = mystat(st);
+  st->nacquire++;
+  if(contended){
+    st->ncontend++;
+    st->waitcycles += wait;
+  }
+  pop_off();
+}
+
+// Count how a contended sleeplock acquisition waited.
+void
+lockstat_waited(struct lockstat *st, int slept)
+{
+  push_off();
+  st = mystat(st);
+  if(slept)
+    st->nsleep++;
+  else
+    st->nspin++;
+  pop_off();
+}
+
+// Count a release of a lock with record st held since start.
+void
+lockstat_released(struct lockstat *st, uint64 start)
+{
+  uint64 hold = r_cycle() - start;
+
+  push_off();
+  st = mystat(st);
+  if(hold > st->maxhold)
+    st->maxhold = hold;
+  pop_off();
+}
+
+// Read the records starting at byte off,
+// summing each over the CPUs.
+static int
+lockstatread(int user_dst, uint64 dst, int n, uint off)
+{
+  struct lockstat sum, *st;
+  uint size = nstats * sizeof(struct lockstat);
+  int i, c, m, tot;
+
+  if(off >= size)
+    return 0;
+  if(n > size - off)
+    n = size - off;
+  for(tot = 0; tot < n; tot += m, off += m){
+    i = off / sizeof(sum);
+    sum = stats[0][i];
+    for(c = 1; c < NCPU; c++){
+      st = &stats[c][i];
+      sum.nacquire += st->nacquire;
+      sum.ncontend += st->ncontend;
+      sum.waitcycles += st->waitcycles;
+      sum.nspin += st->nspin;
+      sum.nsleep += st->nsleep;
+      if(st->maxhold > sum.maxhold)
+        sum.maxhold = st->maxhold;
+    }
+    m = sizeof(sum) - off % sizeof(sum);
+    if(m > n - tot)
+      m = n - tot;
+    if(either_copyout(user_dst, dst + tot, (char*)&sum + off % sizeof(sum), m) < 0)
+      return -1;
+  }
+  return n;
+}
+
+void
+lockstatinit(void)
+{
+  devsw[LOCKSTAT].read = lockstatread;
+  devsw[LOCKSTAT].write = 0;
+}
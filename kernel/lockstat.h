@@ -0,0 +1,16 @@
+// Per-lock-class contention statistics, as read
+// from the lockstat device. Locks initialized with
+// the same name share one record.
+#define LS_SPIN   1   // spinlock
+#define LS_SLEEP  2   // sleeplock
+
+struct lockstat {
+  char name[16];      // lock name
+  int type;           // LS_SPIN or LS_SLEEP
+  uint64 nacquire;    // acquisitions
+  uint64 ncontend;    // acquisitions that found the lock held
+  uint64 waitcycles;  // cycles spent spinning, or asleep for sleeplocks
+  uint64 maxhold;     // longest time held, in cycles
+  uint64 nspin;       // sleeplock waits that ended while spinning
+  uint64 nsleep;      // sleeplock waits that had to sleep
+};
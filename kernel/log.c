@@ -2,10 +2,12 @@
 #include "riscv.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "timer.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -19,63 +21,116 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the transaction commits.
+//
+// Commits are made by the flusher kernel thread, not by the
+// system calls: COMMITDELAY after a transaction logs its first
+// block, or sooner if the log is filling up or fsync() is
+// waiting, the flusher closes the transaction to new system
+// calls, waits for the ones inside it to end, and commits it.
+// Transactions are numbered so that fsync() can wait for just
+// the one holding a file's last change.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
+//     and the slot holding each one's latest copy
+//   slot 0
+//   slot 1
 //   ...
 // Log appends are synchronous.
+//
+// The slots are used as a circular buffer. A commit appends
+// the transaction's blocks at the head and rewrites the header
+// to list every block whose committed copy has not been
+// written home yet. Blocks are not written home (checkpointed)
+// at commit; they stay pinned in the buffer cache, and a block
+// changed again by a later transaction just gets a newer slot.
+// Only when fewer than a transaction's worth of slots are free
+// does the flusher checkpoint the blocks in the older half of
+// the log, so a hot block such as a bitmap block goes home
+// once per checkpoint rather than once per commit.
+//
+// Only metadata goes through the log: inodes, bitmaps,
+// indirect blocks and directory contents. writei() writes a
+// regular file's data blocks straight to their home locations
+// before the system call ends, and so before the commit that
+// makes the blocks part of the file (ordered mode). A block
+// freed during a transaction is not handed out again until
+// the transaction commits, since until then the file that
+// freed it still owns it on disk; nor while it has a copy in
+// the log, which recovery would write over the new data.
 
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// Contents of the header block: the committed blocks
+// not yet checkpointed, and their slots.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int block[LOGBLOCKS];
+  int slot[LOGBLOCKS];
 };
 
+// how long a transaction gathers operations before it commits.
+#define COMMITDELAY (CLINT_HZ/20)  // 50 ms
+
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int nslot;       // data blocks in the log.
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int committing;  // closed or in commit(), please wait.
+  int hurry;       // someone wants a commit now.
+  int timedout;    // COMMITDELAY is up.
+  int tid;         // number of the open transaction.
+  int done;        // number of the last committed transaction.
   int dev;
-  struct logheader lh;
+  int n;           // blocks in the open transaction,
+  int block[LOGSIZE]; // and their block #s.
+  struct logheader lh; // committed blocks, pinned in the cache,
+  uint pos[LOGBLOCKS]; // and their positions.
+  uint head;       // position of the next slot to write.
+  uint tail;       // oldest position that may be in lh.
+  int nfreed;      // blocks freed in this transaction
+  uchar freed[(FSSIZE+7)/8];
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void checkpoint(void);
+static void flusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
+  if (sb->size > FSSIZE)
+    panic("initlog: file system too big");
+
+  if (sb->nlog - 1 > LOGBLOCKS || sb->nlog - 1 < 2*LOGSIZE)
+    panic("initlog: bad log size");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
-  log.size = sb->nlog;
+  log.nslot = sb->nlog - 1;
   log.dev = dev;
+  log.tid = 1;
   recover_from_log();
+  kthread("flusher", flusher);
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// after a crash.
 static void
 install_trans(void)
 {
-  int tail;
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
+  for (i = 0; i < log.lh.n; i++) {
+    struct buf *lbuf = bread(log.dev, log.start+log.lh.slot[i]+1); // read log block
+    struct buf *dbuf = bread(log.dev, log.lh.block[i]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
     brelse(lbuf);
     brelse(dbuf);
   }
@@ -91,6 +146,7 @@ read_head(void)
   log.lh.n = lh->n;
   for (i = 0; i < log.lh.n; i++) {
     log.lh.block[i] = lh->block[i];
+    log.lh.slot[i] = lh->slot[i];
   }
   brelse(buf);
 }
@@ -107,6 +163,7 @@ write_head(void)
   hb->n = log.lh.n;
   for (i = 0; i < log.lh.n; i++) {
     hb->block[i] = log.lh.block[i];
+    hb->slot[i] = log.pos[i] % log.nslot;
   }
   bwrite(buf);
   brelse(buf);
@@ -119,6 +176,7 @@ recover_from_log(void)
   install_trans(); // if committed, copy from log to disk
   log.lh.n = 0;
   write_head(); // clear the log
+  log.head = log.tail = 0;
 }
 
 // called at the start of each FS system call.
@@ -129,8 +187,10 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
+      log.hurry = 1;
+      wakeup(&log.hurry);
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -141,49 +201,134 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
-  }
+  // the flusher may be waiting for the last operation
+  // of a closed transaction, and begin_op() may be
+  // waiting for the log space this one reserved.
+  wakeup(&log);
   release(&log.lock);
+}
+
+static void
+committimer(struct timer *t)
+{
+  acquire(&log.lock);
+  log.timedout = 1;
+  wakeup(&log.hurry);
+  release(&log.lock);
+}
+
+// The flusher thread commits each transaction once it has
+// gathered operations for COMMITDELAY, or when asked to.
+// The timer is armed and cancelled without log.lock held,
+// since committimer() takes log.lock under the timer
+// queue's lock.
+static void
+flusher(void)
+{
+  struct timer t;
+
+  t.fn = committimer;
+  t.arg = 0;
+  for(;;){
+    acquire(&log.lock);
+    while(log.n == 0 && !log.hurry)
+      sleep(&log.hurry, &log.lock);
+    log.timedout = 0;
+    release(&log.lock);
+
+    t.expires = r_time() + COMMITDELAY;
+    timer_add(&t);
+    acquire(&log.lock);
+    while(!log.hurry && !log.timedout)
+      sleep(&log.hurry, &log.lock);
+    release(&log.lock);
+    timer_del(&t);
+
+    // close the transaction and let its operations finish.
+    acquire(&log.lock);
+    log.hurry = 0;
+    log.committing = 1;
+    while(log.outstanding > 0)
+      sleep(&log, &log.lock);
+    release(&log.lock);
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
     commit();
+
     acquire(&log.lock);
+    log.done = log.tid++;
     log.committing = 0;
     wakeup(&log);
     release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// The number of the open transaction. Inside begin_op()/end_op()
+// this is the transaction the caller's changes will commit in.
+int
+log_tid(void)
+{
+  int tid;
+
+  acquire(&log.lock);
+  tid = log.tid;
+  release(&log.lock);
+  return tid;
+}
+
+// Wait until transaction tid has committed, asking the
+// flusher not to wait out COMMITDELAY. Must not be
+// called inside a transaction.
+void
+log_force(int tid)
+{
+  acquire(&log.lock);
+  while(log.done < tid){
+    log.hurry = 1;
+    wakeup(&log.hurry);
+    sleep(&log, &log.lock);
+  }
+  release(&log.lock);
+}
+
+// Index of block b in lh, or -1.
+static int
+lookup(int b)
+{
+  int i;
+
+  for (i = 0; i < log.lh.n; i++)
+    if (log.lh.block[i] == b)
+      return i;
+  return -1;
+}
+
+// Copy the open transaction's blocks from cache to the log
+// at the head, and enter them in lh. A block already in lh
+// takes its new position and drops the transaction's pin.
 static void
 write_log(void)
 {
-  int tail;
+  int i, j;
+  uint pos;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+  for (i = 0; i < log.n; i++) {
+    pos = log.head++;
+    struct buf *to = bread(log.dev, log.start+pos%log.nslot+1); // log block
+    struct buf *from = bread(log.dev, log.block[i]); // cache block
     memmove(to->data, from->data, BSIZE);
     bwrite(to);  // write the log
+    if ((j = lookup(log.block[i])) >= 0) {
+      bunpin(from);  // log absorbtion across transactions
+    } else {
+      j = log.lh.n++;
+      log.lh.block[j] = log.block[i];
+    }
+    log.pos[j] = pos;
     brelse(from);
     brelse(to);
   }
@@ -192,15 +337,50 @@ write_log(void)
 static void
 commit()
 {
-  if (log.lh.n > 0) {
+  if (log.n > 0) {
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    if (log.nfreed > 0) {
+      memset(log.freed, 0, sizeof(log.freed));
+      log.nfreed = 0;
+    }
+    log.n = 0;
+    if (log.nslot - (log.head - log.tail) < LOGSIZE)
+      checkpoint();
   }
 }
 
+// Write home the blocks whose latest copies are in the
+// older half of the log, and drop them from the header.
+// Called only between transactions, when the cache holds
+// exactly the committed contents of every block in lh.
+static void
+checkpoint(void)
+{
+  uint limit;
+  int i, n;
+
+  limit = log.head - log.nslot/2;
+  n = 0;
+  log.tail = log.head;
+  for (i = 0; i < log.lh.n; i++) {
+    if ((int)(log.pos[i] - limit) < 0) {
+      struct buf *bp = bread(log.dev, log.lh.block[i]);
+      bwrite(bp);  // install it
+      bunpin(bp);
+      brelse(bp);
+      continue;
+    }
+    log.lh.block[n] = log.lh.block[i];
+    log.pos[n] = log.pos[i];
+    if ((int)(log.pos[n] - log.tail) < 0)
+      log.tail = log.pos[n];
+    n++;
+  }
+  log.lh.n = n;
+  write_head();    // Free the checkpointed slots
+}
+
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
 // commit()/write_log() will do the disk write.
@@ -215,21 +395,46 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.n >= LOGSIZE)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorbtion
+  for (i = 0; i < log.n; i++) {
+    if (log.block[i] == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
+  log.block[i] = b->blockno;
+  if (i == log.n) {  // Add new block to log?
     bpin(b);
-    log.lh.n++;
+    log.n++;
+    if (log.n == 1)
+      wakeup(&log.hurry);  // start the flusher's clock
   }
   release(&log.lock);
 }
 
+
+// Note that block b was freed by the current transaction.
+void
+log_free(uint b)
+{
+  acquire(&log.lock);
+  log.freed[b/8] |= 1 << (b % 8);
+  log.nfreed++;
+  release(&log.lock);
+}
+
+// Must block b wait before it is reallocated? It must if the
+// current transaction freed it, or if the log holds a copy.
+int
+log_busy(uint b)
+{
+  int r;
+
+  acquire(&log.lock);
+  r = (log.freed[b/8] & (1 << (b % 8))) != 0 || lookup(b) >= 0;
+  release(&log.lock);
+  return r;
+}
@@ -2,6 +2,8 @@
 #include "param.h"
 #include "memlayout.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 
 volatile static int started = 0;
@@ -20,13 +22,16 @@ main()
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
+    futexinit();     // futex wait queues
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode cache
+    dcacheinit();    // directory entry cache
     fileinit();      // file table
+    lockstatinit();  // lock statistics device
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -41,5 +46,6 @@ main()
     plicinithart();   // ask PLIC for device interrupts
   }
 
+  mycpu()->online = 1;
   scheduler();        
 }
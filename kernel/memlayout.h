@@ -27,8 +27,10 @@
 
 // local interrupt controller, which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid))
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define CLINT_HZ 10000000L           // mtime frequency in qemu.
 
 // qemu puts programmable interrupt controller here.
 #define PLIC 0x0c000000L
@@ -53,7 +55,10 @@
 
 // map kernel stacks beneath the trampoline,
 // each surrounded by invalid guard pages.
-#define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
+// every proc also uses a page for itself and one
+// for its trapframe, which bounds how many there are.
+#define KSTACK(i) (TRAMPOLINE - ((i)+1)* 2*PGSIZE)
+#define NKSTACK ((PHYSTOP - KERNBASE) / (3*PGSIZE))
 
 // User memory layout.
 // Address zero first:
@@ -62,6 +67,9 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   ...
+//   TRAPFRAME - (NTHREAD-1)*PGSIZE (other threads' p->trapframe)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define NTHREAD 64  // threads per address space, one trapframe slot each
@@ -1,13 +1,18 @@
-#define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // i-nodes cached before recycling unused ones
+#define NDENTRY     256  // directory entries cached by name
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXOPBLOCKS  12  // max # of blocks any FS op writes; see dxinsert()
+#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in a transaction
+#define LOGBLOCKS    (LOGSIZE*2)  // data blocks in on-disk log
+#define NBUF         (LOGBLOCKS+MAXOPBLOCKS*2)  // min size of disk block cache; the log pins up to LOGBLOCKS
+#define BCACHEFRAC   8  // disk block cache may grow to 1/BCACHEFRAC of memory
+#define FSSIZE       4000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define PIPEMAXPAGES 16    // maximum pages in a pipe buffer
+#define TICKCYCLES   1000000  // mtime cycles per clock tick (about 1/10th second)
+#define SLEEPLOCK_SPIN 20000  // cycles acquiresleep() spins on a running holder
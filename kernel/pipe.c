@@ -7,18 +7,41 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 
-#define PIPESIZE 512
-
+// The pipe's data lives in size bytes of whole pages, size
+// being a power of two so that the running byte counts nread
+// and nwrite can wrap. Each pass of piperead() and pipewrite()
+// copies the largest run that is contiguous in one page.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEMAXPAGES];
+  uint size;      // bytes of buffer
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct pollhead pollers;  // poll()s waiting for either end
 };
 
+// Where byte number i of the stream lives in the buffer.
+static char*
+pipebuf(struct pipe *pi, uint i)
+{
+  i %= pi->size;
+  return pi->page[i / PGSIZE] + i % PGSIZE;
+}
+
+static void
+pipefree(struct pipe *pi)
+{
+  int i;
+
+  for(i = 0; i < pi->size / PGSIZE; i++)
+    kfree(pi->page[i]);
+  kfree((char*)pi);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,10 +53,17 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  if((pi->page[0] = kalloc()) == 0){
+    kfree((char*)pi);
+    pi = 0;
+    goto bad;
+  }
+  pi->size = PGSIZE;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->pollers.head = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,7 +77,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -66,35 +96,79 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pollnotify(&pi->pollers);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// Copy up to n bytes from src into pi, as many as there is
+// room for, a page-contiguous run at a time.
+// Caller must hold pi->lock. Returns the number copied.
+static int
+pipein(struct pipe *pi, int user_src, uint64 src, int n)
+{
+  int i, m;
+
+  for(i = 0; i < n && pi->nwrite != pi->nread + pi->size; i += m){
+    m = n - i;
+    if(m > pi->nread + pi->size - pi->nwrite)
+      m = pi->nread + pi->size - pi->nwrite;
+    if(m > PGSIZE - pi->nwrite % PGSIZE)
+      m = PGSIZE - pi->nwrite % PGSIZE;
+    if(either_copyin(pipebuf(pi, pi->nwrite), user_src, src + i, m) == -1)
+      break;
+    pi->nwrite += m;
+  }
+  return i;
+}
+
+// Copy up to n bytes out of pi to dst, as many as are there.
+// Caller must hold pi->lock. Returns the number copied.
+static int
+pipeout(struct pipe *pi, int user_dst, uint64 dst, int n)
+{
+  int i, m;
+
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){
+    m = n - i;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > PGSIZE - pi->nread % PGSIZE)
+      m = PGSIZE - pi->nread % PGSIZE;
+    if(either_copyout(user_dst, dst + i, pipebuf(pi, pi->nread), m) == -1)
+      break;
+    pi->nread += m;
+  }
+  return i;
+}
+
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
-  char ch;
+  int i, m;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
-  for(i = 0; i < n; i++){
-    while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
+  i = 0;
+  while(i < n){
+    while(pi->nwrite == pi->nread + pi->size){  //DOC: pipewrite-full
       if(pi->readopen == 0 || pr->killed){
         release(&pi->lock);
         return -1;
       }
       wakeup(&pi->nread);
+      pollnotify(&pi->pollers);
       sleep(&pi->nwrite, &pi->lock);
     }
-    if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+    if((m = pipein(pi, 1, addr + i, n - i)) == 0)
       break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
+    i += m;
   }
   wakeup(&pi->nread);
+  pollnotify(&pi->pollers);
   release(&pi->lock);
   return i;
 }
@@ -104,7 +178,6 @@ piperead(struct pipe *pi, uint64 addr, int n)
 {
   int i;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -114,14 +187,174 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
+  i = pipeout(pi, 1, addr, n);  //DOC: piperead-copy
+  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  pollnotify(&pi->pollers);
+  release(&pi->lock);
+  return i;
+}
+
+// Wait until pi has room for a write if writable, or else
+// until it has data to read or its writer is gone.
+// Returns 1 if pi is ready, 0 at end of file, or -1 if
+// the reader is gone or the process was killed.
+int
+pipewait(struct pipe *pi, int writable)
+{
+  struct proc *pr = myproc();
+  int r;
+
+  acquire(&pi->lock);
+  for(;;){
+    if(writable && pi->readopen == 0){
+      r = -1;
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    }
+    if(writable ? pi->nwrite != pi->nread + pi->size : pi->nread != pi->nwrite){
+      r = 1;
+      break;
+    }
+    if(!writable && pi->writeopen == 0){
+      r = 0;
+      break;
+    }
+    if(pr->killed){
+      r = -1;
       break;
+    }
+    sleep(writable ? &pi->nwrite : &pi->nread, &pi->lock);
+  }
+  release(&pi->lock);
+  return r;
+}
+
+// Append up to n bytes at kernel address src to pi without
+// waiting for room. Returns the number appended, or -1 if
+// the reader is gone.
+int
+pipeput(struct pipe *pi, char *src, int n)
+{
+  int i;
+
+  acquire(&pi->lock);
+  if(pi->readopen == 0){
+    release(&pi->lock);
+    return -1;
+  }
+  if((i = pipein(pi, 0, (uint64)src, n)) > 0){
+    wakeup(&pi->nread);
+    pollnotify(&pi->pollers);
+  }
+  release(&pi->lock);
+  return i;
+}
+
+// Take up to n bytes from pi to kernel address dst without
+// waiting for data. Returns the number taken.
+int
+pipeget(struct pipe *pi, char *dst, int n)
+{
+  int i;
+
+  acquire(&pi->lock);
+  if((i = pipeout(pi, 0, (uint64)dst, n)) > 0){
+    wakeup(&pi->nwrite);
+    pollnotify(&pi->pollers);
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+// Resize pi's buffer to hold at least n bytes, rounded up
+// to a power-of-two number of pages. Fails if n is too large
+// or the buffered data would not fit.
+// Returns the new size, or -1.
+int
+pipesetsize(struct pipe *pi, int n)
+{
+  char *page[PIPEMAXPAGES], *old[PIPEMAXPAGES];
+  int i, npages, nold;
+  uint size, oldsize, j, m;
+
+  if(n <= 0 || n > PIPEMAXPAGES * PGSIZE)
+    return -1;
+  for(size = PGSIZE; size < n; size *= 2)
+    ;
+  npages = size / PGSIZE;
+  for(i = 0; i < npages; i++){
+    if((page[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(page[i]);
+      return -1;
+    }
+  }
+
+  acquire(&pi->lock);
+  if(pi->nwrite - pi->nread > size){
+    release(&pi->lock);
+    for(i = 0; i < npages; i++)
+      kfree(page[i]);
+    return -1;
+  }
+  // keep each buffered byte at its stream position
+  // modulo the new size, so nread and nwrite stand.
+  oldsize = pi->size;
+  nold = oldsize / PGSIZE;
+  for(i = 0; i < nold; i++)
+    old[i] = pi->page[i];
+  for(j = pi->nread; j != pi->nwrite; j += m){
+    m = pi->nwrite - j;
+    if(m > PGSIZE - j % PGSIZE)
+      m = PGSIZE - j % PGSIZE;
+    memmove(page[(j % size) / PGSIZE] + j % PGSIZE, pipebuf(pi, j), m);
+  }
+  for(i = 0; i < npages; i++)
+    pi->page[i] = page[i];
+  pi->size = size;
+  // a larger buffer may have room for blocked writers.
+  wakeup(&pi->nwrite);
+  pollnotify(&pi->pollers);
+  release(&pi->lock);
+
+  for(i = 0; i < nold; i++)
+    kfree(old[i]);
+  return size;
+}
+
+int
+pipegetsize(struct pipe *pi)
+{
+  int size;
+
+  acquire(&pi->lock);
+  size = pi->size;
+  release(&pi->lock);
+  return size;
+}
+
+// Which of events are ready on the read end of pi, or on
+// the write end if writable, plus POLLHUP or POLLERR.
+int
+pipepoll(struct pipe *pi, int writable, int events, struct pollent *pe)
+{
+  int mask;
+
+  acquire(&pi->lock);
+  mask = 0;
+  if(writable){
+    if(pi->readopen == 0)
+      mask |= POLLERR;
+    else if(pi->nwrite != pi->nread + pi->size)
+      mask |= POLLOUT;
+  } else {
+    if(pi->nread != pi->nwrite)
+      mask |= POLLIN;
+    if(pi->writeopen == 0)
+      mask |= POLLHUP;
+  }
+  mask &= events | POLLERR | POLLHUP;
+  if(mask == 0 && pe)
+    pollwait(&pi->pollers, &pi->lock, pe);
+  release(&pi->lock);
+  return mask;
+}
@@ -0,0 +1,170 @@
+//
+// poll(): wait until any of several files is ready.
+//
+// poll() asks each file whether it is ready, and while none
+// is, hooks a pollent onto the pollhead of each pipe or
+// device it polled. Whatever makes such an object ready
+// calls pollnotify() on its pollhead with the object's lock
+// held, which wakes every poll() waiting on it; poll() then
+// unhooks and looks again. Checking readiness and hooking on
+// happen under the same object lock, so no change is missed.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "poll.h"
+#include "timer.h"
+#include "defs.h"
+
+struct poller {
+  struct spinlock lock;
+  int woken;       // something changed since the last scan
+  int timedout;    // the timeout has expired
+};
+
+// Hook pe onto ph, for the poll() that pe belongs to.
+// Caller must hold lk, which protects ph.
+void
+pollwait(struct pollhead *ph, struct spinlock *lk, struct pollent *pe)
+{
+  pe->lk = lk;
+  pe->next = ph->head;
+  pe->pprev = &ph->head;
+  if(ph->head)
+    ph->head->pprev = &pe->next;
+  ph->head = pe;
+}
+
+// Wake every poll() hooked onto ph.
+// Caller must hold the lock protecting ph.
+void
+pollnotify(struct pollhead *ph)
+{
+  struct pollent *pe;
+
+  for(pe = ph->head; pe; pe = pe->next){
+    acquire(&pe->pt->lock);
+    pe->pt->woken = 1;
+    wakeup(pe->pt);
+    release(&pe->pt->lock);
+  }
+}
+
+// Unhook pe, if pollwait() hooked it onto something.
+static void
+pollremove(struct pollent *pe)
+{
+  if(pe->lk == 0)
+    return;
+  acquire(pe->lk);
+  if(pe->next)
+    pe->next->pprev = pe->pprev;
+  *pe->pprev = pe->next;
+  release(pe->lk);
+  pe->lk = 0;
+}
+
+static void
+polltimeout(struct timer *t)
+{
+  struct poller *pt = t->arg;
+
+  acquire(&pt->lock);
+  pt->woken = 1;
+  pt->timedout = 1;
+  wakeup(pt);
+  release(&pt->lock);
+}
+
+// Wait until one of the nfds descriptors in the pollfd array
+// at user address ufds is ready, or for timeout milliseconds
+// if timeout is not negative. Sets each revents, and returns
+// how many descriptors are ready, or -1.
+int
+poll(uint64 ufds, int nfds, int timeout)
+{
+  struct pollfd fds[NOFILE];
+  struct pollent pe[NOFILE];
+  struct file *f[NOFILE];
+  struct poller pt;
+  struct timer t;
+  struct proc *p = myproc();
+  int i, n;
+
+  if(nfds < 0 || nfds > NOFILE)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, ufds, nfds * sizeof(fds[0])) < 0)
+    return -1;
+
+  // hold our own references, in case another
+  // thread closes a descriptor while we wait.
+  for(i = 0; i < nfds; i++){
+    f[i] = 0;
+    if(fds[i].fd >= 0 && fds[i].fd < NOFILE && p->ofile[fds[i].fd])
+      f[i] = filedup(p->ofile[fds[i].fd]);
+    pe[i].pt = &pt;
+    pe[i].lk = 0;
+  }
+
+  initlock(&pt.lock, "poll");
+  pt.timedout = 0;
+  if(timeout > 0){
+    t.expires = r_time() + (uint64)timeout * (CLINT_HZ / 1000);
+    t.fn = polltimeout;
+    t.arg = &pt;
+    timer_add(&t);
+  }
+
+  for(;;){
+    acquire(&pt.lock);
+    pt.woken = 0;
+    release(&pt.lock);
+
+    n = 0;
+    for(i = 0; i < nfds; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if(f[i] == 0)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = filepoll(f[i], fds[i].events, n ? 0 : &pe[i]);
+      if(fds[i].revents)
+        n++;
+    }
+    if(n || timeout == 0 || pt.timedout || p->killed)
+      break;
+
+    acquire(&pt.lock);
+    while(!pt.woken && !p->killed)
+      sleep(&pt, &pt.lock);
+    release(&pt.lock);
+
+    for(i = 0; i < nfds; i++)
+      pollremove(&pe[i]);
+  }
+
+  for(i = 0; i < nfds; i++)
+    pollremove(&pe[i]);
+  // pt and t are on this stack: timer_del() also waits out a
+  // polltimeout() already running on the hart that queued t,
+  // which may not be this one any more.
+  if(timeout > 0)
+    timer_del(&t);
+  for(i = 0; i < nfds; i++)
+    if(f[i])
+      fileclose(f[i]);
+
+  if(p->killed)
+    return -1;
+  if(copyout(p->pagetable, ufds, (char*)fds, nfds * sizeof(fds[0])) < 0)
+    return -1;
+  return n;
+}
@@ -0,0 +1,12 @@
+// poll() request for one file descriptor.
+struct pollfd {
+  int fd;          // ignored if negative
+  short events;    // POLLIN and/or POLLOUT
+  short revents;   // set by poll()
+};
+
+#define POLLIN   0x1   // read would not block
+#define POLLOUT  0x4   // write would not block
+#define POLLERR  0x8   // write end of a pipe with no reader; always reported
+#define POLLHUP  0x10  // read end of a pipe with no writer; always reported
+#define POLLNVAL 0x20  // fd is not open; always reported
@@ -4,44 +4,67 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "timer.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
-
 struct proc *initproc;
 
 int nextpid = 1;
-struct spinlock pid_lock;
+
+// Every allocated proc is on a pid hash chain, linked
+// through p->pidnext; there is no table of all procs.
+#define NPIDHASH 128
+struct spinlock pidhash_lock;
+struct proc *pidhash[NPIDHASH];
+
+// RUNNABLE processes in FIFO order, linked through p->rqnext.
+// A RUNNABLE process is on the queue unless a scheduler
+// has just taken it off to run it.
+struct {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc **tail;
+} runq;
+
+// Processes in sleep(), hashed by channel and
+// linked through p->sqnext.
+#define NSLEEPQ 61   // prime
+#define SLEEPQ(chan) (&sleepq[((uint64)(chan) >> 3) % NSLEEPQ])
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
+// helps ensure that wakeups of wait()ing
+// parents are not lost. helps obey the
+// memory model when using p->parent.
+// must be acquired before any p->lock.
+struct spinlock wait_lock;
 
 extern void forkret(void);
-static void wakeup1(struct proc *chan);
 static void freeproc(struct proc *p);
+static int waitchild(int want, uint64 addr, int thread);
+static void addchild(struct proc *p, struct proc *np, int thread);
+static void makerunnable(struct proc *p);
+static void wakeidle(uint64 mask);
 
 extern char trampoline[]; // trampoline.S
 
-// initialize the proc table at boot time.
+// initialize the process queues at boot time.
 void
 procinit(void)
 {
-  struct proc *p;
+  int i;
   
-  initlock(&pid_lock, "nextpid");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-
-      // Allocate a page for the process's kernel stack.
-      // Map it high in memory, followed by an invalid
-      // guard page.
-      char *pa = kalloc();
-      if(pa == 0)
-        panic("kalloc");
-      uint64 va = KSTACK((int) (p - proc));
-      kvmmap(va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-      p->kstack = va;
-  }
-  kvminithart();
+  initlock(&pidhash_lock, "pidhash");
+  initlock(&wait_lock, "wait_lock");
+  initlock(&runq.lock, "runq");
+  runq.head = 0;
+  runq.tail = &runq.head;
+  for(i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
 }
 
 // Must be called with interrupts disabled,
@@ -75,81 +98,240 @@ myproc(void) {
 
 int
 allocpid() {
-  int pid;
-  
-  acquire(&pid_lock);
-  pid = nextpid;
-  nextpid = nextpid + 1;
-  release(&pid_lock);
+  return __sync_fetch_and_add(&nextpid, 1);
+}
 
-  return pid;
+static void
+pidhash_insert(struct proc *p)
+{
+  struct proc **pp = &pidhash[p->pid % NPIDHASH];
+
+  acquire(&pidhash_lock);
+  p->pidnext = *pp;
+  *pp = p;
+  release(&pidhash_lock);
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+static void
+pidhash_remove(struct proc *p)
+{
+  struct proc **pp;
+
+  acquire(&pidhash_lock);
+  for(pp = &pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  release(&pidhash_lock);
+}
+
+// Find the proc with the given pid and return it
+// with p->lock held, or return 0.
 static struct proc*
-allocproc(void)
+findproc(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&pidhash_lock);
+  for(p = pidhash[pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  // freeproc() takes p off the chain before it waits
+  // for p->lock, so p stays allocated while we hold it.
+  if(p)
     acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
-  }
-  return 0;
+  release(&pidhash_lock);
+  return p;
+}
 
-found:
-  p->pid = allocpid();
+// Allocate a proc, its kernel stack and its trapframe.
+// Initialize state required to run in the kernel,
+// and return with p->lock held.
+// If a memory allocation fails, return 0.
+static struct proc*
+allocproc(void)
+{
+  struct proc *p;
 
-  // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
-    release(&p->lock);
+  if((p = (struct proc*)kalloc()) == 0)
     return 0;
-  }
+  memset(p, 0, sizeof(*p));
+  initlock(&p->lock, "proc");
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
+  // Allocate the process's kernel stack, mapped above a
+  // guard page, and a page for its trapframe.
+  if((p->kstack = kstackalloc()) == 0){
+    kfree((void*)p);
+    return 0;
+  }
+  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+    kstackfree(p->kstack);
+    kfree((void*)p);
     return 0;
   }
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
-  memset(&p->context, 0, sizeof(p->context));
   p->context.ra = (uint64)forkret;
   p->context.sp = p->kstack + PGSIZE;
 
+  p->cpumask = ~0UL;
+  p->lastcpu = -1;
+
+  p->pid = allocpid();
+  pidhash_insert(p);
+
+  acquire(&p->lock);
   return p;
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
-// p->lock must be held.
+// including user pages if no other thread shares them.
+// p must be on no list but the pid hash, and p->lock
+// must not be held.
 static void
 freeproc(struct proc *p)
 {
-  if(p->trapframe)
-    kfree((void*)p->trapframe);
-  p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
-  p->pid = 0;
-  p->parent = 0;
-  p->name[0] = 0;
-  p->chan = 0;
-  p->killed = 0;
-  p->xstate = 0;
-  p->state = UNUSED;
+  pidhash_remove(p);
+  // wait out any findproc() caller that still has p, and
+  // make sure p's final swtch() in sched() has finished.
+  acquire(&p->lock);
+  release(&p->lock);
+
+  if(p->mm)
+    mmput(p->mm, p->tfva);
+  kfree((void*)p->trapframe);
+  kstackfree(p->kstack);
+  kfree((void*)p);
+}
+
+// Allocate an address space with no page table yet,
+// and with trapframe slot 0 (TRAPFRAME) in use.
+// Returns 0 if out of memory.
+struct mm*
+mmalloc(void)
+{
+  struct mm *mm;
+
+  if((mm = (struct mm*)kalloc()) == 0)
+    return 0;
+  initlock(&mm->lock, "mm");
+  mm->ref = 1;
+  mm->pagetable = 0;
+  mm->sz = 0;
+  mm->tfslots = 1;
+  return mm;
+}
+
+// Give p a new, empty address space.
+// Returns 0 on success, -1 if out of memory.
+static int
+allocmm(struct proc *p)
+{
+  struct mm *mm;
+
+  if((mm = mmalloc()) == 0)
+    return -1;
+  p->tfva = TRAPFRAME;
+  if((mm->pagetable = proc_pagetable(p)) == 0){
+    kfree((void*)mm);
+    return -1;
+  }
+  p->mm = mm;
+  p->pagetable = mm->pagetable;
+  return 0;
+}
+
+// Drop a reference to mm held by the thread whose
+// trapframe is mapped at tfva, freeing the address space
+// if no threads are left using it.
+void
+mmput(struct mm *mm, uint64 tfva)
+{
+  int last;
+
+  acquire(&mm->lock);
+  uvmunmap(mm->pagetable, tfva, 1, 0);
+  mm->tfslots &= ~(1UL << ((TRAPFRAME - tfva) / PGSIZE));
+  last = --mm->ref == 0;
+  release(&mm->lock);
+
+  if(last){
+    uvmunmap(mm->pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(mm->pagetable, mm->sz);
+    kfree((void*)mm);
+  }
+}
+
+// Make sure no other hart still has TLB entries for mappings
+// just removed from mm. uservec and userret flush the TLB
+// whenever a hart switches page tables, so it is enough to
+// interrupt each hart that is in user mode in mm and wait
+// for it to trap into the kernel. Then wait for any hart
+// that copyin() or copyout() has pinned a page of mm on,
+// so that the caller can free the pages it unmapped.
+void
+tlbshootdown(struct mm *mm)
+{
+  struct cpu *c;
+  uint64 gen[NCPU];
+  int i, me;
+
+  // order the caller's PTE updates before reading ugen;
+  // pairs with the fence in usertrapret().
+  __sync_synchronize();
+
+  push_off();
+  me = cpuid();
+  for(i = 0; i < NCPU; i++){
+    c = &cpus[i];
+    gen[i] = c->ugen;
+    if(i == me || (gen[i] & 1) == 0 || c->umm != mm){
+      gen[i] = 0;
+      continue;
+    }
+    *(uint32*)CLINT_MSIP(i) = 1;
+  }
+  for(i = 0; i < NCPU; i++)
+    while((gen[i] & 1) && *(volatile uint64*)&cpus[i].ugen == gen[i])
+      ;
+  // a hart that pins a page after this sees the cleared PTE.
+  for(i = 0; i < NCPU; i++)
+    while(i != me && *(pagetable_t volatile *)&cpus[i].upin == mm->pagetable)
+      ;
+  pop_off();
+}
+
+// Shrink an address space that other threads may be using
+// from oldsz to newsz. Unmaps a batch of pages at a time and
+// frees the batch only after tlbshootdown().
+// Caller must hold mm->lock. Returns the new size.
+static uint64
+mmshrink(struct mm *mm, uint64 oldsz, uint64 newsz)
+{
+  uint64 pa[32], a, end;
+  pte_t *pte;
+  int i, n;
+
+  if(newsz >= oldsz)
+    return oldsz;
+
+  a = PGROUNDUP(newsz);
+  end = PGROUNDUP(oldsz);
+  while(a < end){
+    for(n = 0; a < end && n < NELEM(pa); a += PGSIZE){
+      if((pte = walk(mm->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        panic("mmshrink");
+      pa[n++] = PTE2PA(*pte);
+      *pte = 0;
+    }
+    tlbshootdown(mm);
+    for(i = 0; i < n; i++)
+      kfree((void*)pa[i]);
+  }
+  return newsz;
 }
 
 // Create a user page table for a given process,
@@ -214,12 +396,14 @@ userinit(void)
   struct proc *p;
 
   p = allocproc();
+  if(p == 0 || allocmm(p) < 0)
+    panic("userinit");
   initproc = p;
   
   // allocate one user page and copy init's instructions
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  p->mm->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
@@ -228,28 +412,62 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  makerunnable(p);
 
   release(&p->lock);
 }
 
+// A kernel thread's very first scheduling will swtch here.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  p->kfn();
+  panic("kthread returned");
+}
+
+// Start a kernel thread running fn, which must not return.
+// It has no user memory, no open files and no parent.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  makerunnable(p);
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
-  struct proc *p = myproc();
+  uint64 sz;
+  struct mm *mm = myproc()->mm;
 
-  sz = p->sz;
+  acquire(&mm->lock);
+  sz = mm->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    if((sz = uvmalloc(mm->pagetable, sz, sz + n)) == 0) {
+      release(&mm->lock);
       return -1;
     }
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if(mm->ref > 1)
+      sz = mmshrink(mm, sz, sz + n);
+    else
+      sz = uvmdealloc(mm->pagetable, sz, sz + n);
   }
-  p->sz = sz;
+  mm->sz = sz;
+  release(&mm->lock);
   return 0;
 }
 
@@ -267,16 +485,24 @@ fork(void)
   {
     return -1;
   }
+  if(allocmm(np) < 0){
+    release(&np->lock);
+    freeproc(np);
+    return -1;
+  }
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
-    freeproc(np);
+  acquire(&p->mm->lock);
+  if(uvmcopy(p->pagetable, np->pagetable, p->mm->sz) < 0){
+    release(&p->mm->lock);
     release(&np->lock);
+    freeproc(np);
     return -1;
   }
-  np->sz = p->sz;
+  np->mm->sz = p->mm->sz;
+  release(&p->mm->lock);
 
-  np->parent = p;
+  np->cpumask = p->cpumask;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -294,37 +520,129 @@ fork(void)
 
   pid = np->pid;
 
-  np->state = RUNNABLE;
+  release(&np->lock);
 
+  acquire(&wait_lock);
+  addchild(p, np, 0);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  makerunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
-// Pass p's abandoned children to init.
-// Caller must hold p->lock.
+// Create a thread that shares the caller's address space,
+// starting at fn(arg) on the user stack ending at stack.
+// It gets its own trapframe, and references to the caller's
+// open files and current directory.
+// Returns the new thread's pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int i, slot, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  // map the new thread's trapframe in a free slot.
+  acquire(&mm->lock);
+  for(slot = 0; slot < NTHREAD; slot++)
+    if((mm->tfslots & (1UL << slot)) == 0)
+      break;
+  if(slot == NTHREAD ||
+     mappages(mm->pagetable, TRAPFRAME - slot*PGSIZE, PGSIZE,
+              (uint64)np->trapframe, PTE_R | PTE_W) < 0){
+    release(&mm->lock);
+    release(&np->lock);
+    freeproc(np);
+    return -1;
+  }
+  mm->tfslots |= 1UL << slot;
+  mm->ref++;
+  release(&mm->lock);
+  np->mm = mm;
+  np->pagetable = mm->pagetable;
+  np->tfva = TRAPFRAME - slot*PGSIZE;
+
+  np->cpumask = p->cpumask;
+
+  // start at fn(arg) with the caller's other registers.
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+  np->trapframe->ra = 0;
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  addchild(p, np, 1);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  makerunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Make np a child of p, reaped by join() if thread
+// is set and by wait() otherwise.
+// Caller must hold wait_lock.
+static void
+addchild(struct proc *p, struct proc *np, int thread)
+{
+  np->parent = p;
+  np->thread = thread;
+  np->sibling = p->children;
+  np->psibling = &p->children;
+  if(p->children)
+    p->children->psibling = &np->sibling;
+  p->children = np;
+}
+
+// Remove np from its parent's list of children.
+// Caller must hold wait_lock.
+static void
+delchild(struct proc *np)
+{
+  if(np->sibling)
+    np->sibling->psibling = np->psibling;
+  *np->psibling = np->sibling;
+  np->sibling = 0;
+  np->psibling = 0;
+}
+
+// Pass p's abandoned children to init,
+// as processes so that init's wait() reaps them.
+// Caller must hold wait_lock.
 void
 reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    // this code uses pp->parent without holding pp->lock.
-    // acquiring the lock first could cause a deadlock
-    // if pp or a child of pp were also in exit()
-    // and about to try to lock p.
-    if(pp->parent == p){
-      // pp->parent can't change between the check and the acquire()
-      // because only the parent changes it, and we're the parent.
-      acquire(&pp->lock);
-      pp->parent = initproc;
-      // we should wake up init here, but that would require
-      // initproc->lock, which would be a deadlock, since we hold
-      // the lock on one of init's children (pp). this is why
-      // exit() always wakes init (before acquiring any locks).
-      release(&pp->lock);
-    }
+  if(p->children == 0)
+    return;
+  while((pp = p->children) != 0){
+    delchild(pp);
+    addchild(initproc, pp, 0);
   }
+  // some of them may already be zombies.
+  wakeproc(initproc, initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -352,41 +670,20 @@ exit(int status)
   end_op();
   p->cwd = 0;
 
-  // we might re-parent a child to init. we can't be precise about
-  // waking up init, since we can't acquire its lock once we've
-  // acquired any other proc lock. so wake up init whether that's
-  // necessary or not. init may miss this wakeup, but that seems
-  // harmless.
-  acquire(&initproc->lock);
-  wakeup1(initproc);
-  release(&initproc->lock);
-
-  // grab a copy of p->parent, to ensure that we unlock the same
-  // parent we locked. in case our parent gives us away to init while
-  // we're waiting for the parent lock. we may then race with an
-  // exiting parent, but the result will be a harmless spurious wakeup
-  // to a dead or wrong process; proc structs are never re-allocated
-  // as anything else.
-  acquire(&p->lock);
-  struct proc *original_parent = p->parent;
-  release(&p->lock);
-  
-  // we need the parent's lock in order to wake it up from wait().
-  // the parent-then-child rule says we have to lock it first.
-  acquire(&original_parent->lock);
-
-  acquire(&p->lock);
+  acquire(&wait_lock);
 
   // Give any children to init.
   reparent(p);
 
   // Parent might be sleeping in wait().
-  wakeup1(original_parent);
+  wakeproc(p->parent, p->parent);
+  
+  acquire(&p->lock);
 
   p->xstate = status;
   p->state = ZOMBIE;
 
-  release(&original_parent->lock);
+  release(&wait_lock);
 
   // Jump into the scheduler, never to return.
   sched();
@@ -395,58 +692,126 @@ exit(int status)
 
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
+// Threads created by clone() are left for join().
 int
 wait(uint64 addr)
+{
+  return waitchild(0, addr, 0);
+}
+
+// Wait for thread tid, or any thread if tid is 0, created
+// by this process with clone() to exit and return its pid.
+// Return -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  return waitchild(tid, addr, 1);
+}
+
+// Wait for a child with the given pid (any if 0) that is
+// a thread if thread is set, or a process otherwise.
+static int
+waitchild(int want, uint64 addr, int thread)
 {
   struct proc *np;
   int havekids, pid;
   struct proc *p = myproc();
 
-  // hold p->lock for the whole time to avoid lost
-  // wakeups from a child's exit().
-  acquire(&p->lock);
+  acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for(np = proc; np < &proc[NPROC]; np++){
-      // this code uses np->parent without holding np->lock.
-      // acquiring the lock first would cause a deadlock,
-      // since np might be an ancestor, and we already hold p->lock.
-      if(np->parent == p){
-        // np->parent can't change between the check and the acquire()
-        // because only the parent changes it, and we're the parent.
-        acquire(&np->lock);
-        havekids = 1;
-        if(np->state == ZOMBIE){
-          // Found one.
-          pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&p->lock);
-            return -1;
-          }
-          freeproc(np);
+    for(np = p->children; np; np = np->sibling){
+      if(np->thread != thread || (want != 0 && np->pid != want))
+        continue;
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&np->lock);
+      havekids = 1;
+      if(np->state == ZOMBIE){
+        // Found one.
+        pid = np->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
+                                sizeof(np->xstate)) < 0) {
           release(&np->lock);
-          release(&p->lock);
-          return pid;
+          release(&wait_lock);
+          return -1;
         }
+        delchild(np);
         release(&np->lock);
+        release(&wait_lock);
+        freeproc(np);
+        return pid;
       }
+      release(&np->lock);
     }
 
     // No point waiting if we don't have any children.
     if(!havekids || p->killed){
-      release(&p->lock);
+      release(&wait_lock);
       return -1;
     }
     
     // Wait for a child to exit.
-    sleep(p, &p->lock);  //DOC: wait-sleep
+    sleep(p, &wait_lock);  //DOC: wait-sleep
   }
 }
 
+// Mark p RUNNABLE and queue it for the schedulers.
+// Caller must hold p->lock.
+static void
+makerunnable(struct proc *p)
+{
+  p->state = RUNNABLE;
+  acquire(&runq.lock);
+  p->rqnext = 0;
+  *runq.tail = p;
+  runq.tail = &p->rqnext;
+  release(&runq.lock);
+  wakeidle(p->cpumask);
+}
+
+// Interrupt one idle hart in mask, so that it looks at the
+// run queue again. Clearing c->idle first means each idle
+// spell costs at most one IPI, however many processes are
+// made runnable during it.
+static void
+wakeidle(uint64 mask)
+{
+  struct cpu *c;
+
+  // order the caller's run queue update before reading
+  // c->idle; pairs with the fence in scheduler().
+  __sync_synchronize();
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if((mask & (1UL << (c - cpus))) && c->idle &&
+       __sync_bool_compare_and_swap(&c->idle, 1, 0)){
+      *(uint32*)CLINT_MSIP(c - cpus) = 1;
+      return;
+    }
+  }
+}
+
+// Take the first process off the run queue
+// that may run on CPU id, or return 0.
+static struct proc*
+runq_take(int id)
+{
+  struct proc *p, **pp;
+
+  acquire(&runq.lock);
+  for(pp = &runq.head; (p = *pp) != 0; pp = &p->rqnext){
+    if(p->cpumask & (1UL << id)){
+      *pp = p->rqnext;
+      if(runq.tail == &p->rqnext)
+        runq.tail = pp;
+      break;
+    }
+  }
+  release(&runq.lock);
+  return p;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -459,35 +824,59 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
+  uint64 t0;
   
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
     
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-
-        found = 1;
+    if((p = runq_take(id)) == 0){
+      // nothing to run: sleep until a device, a queued timer
+      // or wakeidle() needs this hart. Look at the run queue
+      // again after setting c->idle, so that a process queued
+      // in between is either seen here or sends an IPI. wfi
+      // returns on a pending interrupt even with interrupts
+      // off, so that IPI cannot be taken just before it.
+      intr_off();
+      c->slice = TIMER_NEVER;
+      timer_program();
+      c->idle = 1;
+      __sync_synchronize();
+      if((p = runq_take(id)) == 0){
+        t0 = r_time();
+        asm volatile("wfi");
+        c->idlecycles += r_time() - t0;
       }
-      release(&p->lock);
-    }
-    if(found == 0) {
-      intr_on();
-      asm volatile("wfi");
+      c->idle = 0;
+      if(p == 0)
+        continue;
     }
+
+    // a process that just gave up another CPU may not
+    // have finished swtch() yet; this waits for it.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler");
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    c->proc = p;
+    if(p->lastcpu >= 0 && p->lastcpu != id)
+      c->nmigrate++;
+    p->lastcpu = id;
+    c->slice = r_time() + TICKCYCLES;
+    timer_program();
+    kstacksync();
+    c->nswtch++;
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -524,7 +913,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  makerunnable(p);
   sched();
   release(&p->lock);
 }
@@ -550,23 +939,45 @@ forkret(void)
   usertrapret();
 }
 
+// Take p off sleep queue sq.
+// Caller must hold sq->lock.
+static void
+sleepq_remove(struct proc *p)
+{
+  if(p->sqnext)
+    p->sqnext->sqpprev = p->sqpprev;
+  *p->sqpprev = p->sqnext;
+  p->sqnext = 0;
+  p->sqpprev = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
-  
+  struct sleepq *sq = SLEEPQ(chan);
+
+  // Join chan's sleep queue while still holding lk,
+  // so that a wakeup(chan), which is called with lk
+  // held, will find us there.
+  acquire(&sq->lock);
+  p->sqnext = sq->head;
+  p->sqpprev = &sq->head;
+  if(sq->head)
+    sq->head->sqpprev = &p->sqnext;
+  sq->head = p;
+  release(&sq->lock);
+
   // Must acquire p->lock in order to
   // change p->state and then call sched.
   // Once we hold p->lock, we can be
   // guaranteed that we won't miss any wakeup
   // (wakeup locks p->lock),
   // so it's okay to release lk.
-  if(lk != &p->lock){  //DOC: sleeplock0
-    acquire(&p->lock);  //DOC: sleeplock1
-    release(lk);
-  }
+  acquire(&p->lock);  //DOC: sleeplock1
+  release(lk);
 
   // Go to sleep.
   p->chan = chan;
@@ -576,12 +987,16 @@ sleep(void *chan, struct spinlock *lk)
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // wakeup() takes us off the queue, but kill() does not.
+  acquire(&sq->lock);
+  if(p->sqpprev)
+    sleepq_remove(p);
+  release(&sq->lock);
 
   // Reacquire original lock.
-  if(lk != &p->lock){
-    release(&p->lock);
-    acquire(lk);
-  }
+  acquire(lk);
 }
 
 // Wake up all processes sleeping on chan.
@@ -589,27 +1004,92 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct sleepq *sq = SLEEPQ(chan);
+  struct proc *p, *np;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&sq->lock);
+  for(p = sq->head; p; p = np) {
+    np = p->sqnext;
     acquire(&p->lock);
     if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
+      sleepq_remove(p);
+      makerunnable(p);
     }
     release(&p->lock);
   }
+  release(&sq->lock);
 }
 
-// Wake up p if it is sleeping in wait(); used by exit().
-// Caller must hold p->lock.
-static void
-wakeup1(struct proc *p)
+// Wake up p if it is sleeping on chan.
+// Must be called without p->lock held.
+void
+wakeproc(struct proc *p, void *chan)
 {
-  if(!holding(&p->lock))
-    panic("wakeup1");
-  if(p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
+  struct sleepq *sq = SLEEPQ(chan);
+
+  acquire(&sq->lock);
+  acquire(&p->lock);
+  if(p->state == SLEEPING && p->chan == chan) {
+    sleepq_remove(p);
+    makerunnable(p);
   }
+  release(&p->lock);
+  release(&sq->lock);
+}
+
+// Restrict the process with the given pid (0 for the
+// caller) to run only on the CPUs in mask.
+// Returns -1 if there is no such process, or if mask
+// includes no CPU that is running.
+int
+setaffinity(int pid, uint64 mask)
+{
+  struct proc *p;
+  uint64 online = 0;
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    if(cpus[i].online)
+      online |= 1UL << i;
+  if((mask & online) == 0)
+    return -1;
+
+  if(pid == 0)
+    pid = myproc()->pid;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->cpumask = mask;
+  // a queued p may now only be runnable on harts that
+  // are idle and would not look at the queue again.
+  if(p->state == RUNNABLE)
+    wakeidle(mask);
+  release(&p->lock);
+  // move off this CPU if it is no longer allowed.
+  if(p == myproc()){
+    push_off();
+    i = cpuid();
+    pop_off();
+    if((mask & (1UL << i)) == 0)
+      yield();
+  }
+  return 0;
+}
+
+// Return the CPU mask of the process with the
+// given pid (0 for the caller), or 0 if there is none.
+uint64
+getaffinity(int pid)
+{
+  struct proc *p;
+  uint64 mask;
+
+  if(pid == 0)
+    pid = myproc()->pid;
+  if((p = findproc(pid)) == 0)
+    return 0;
+  mask = p->cpumask;
+  release(&p->lock);
+  return mask;
 }
 
 // Kill the process with the given pid.
@@ -620,20 +1100,16 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    // sleep() takes itself off its sleep queue.
+    makerunnable(p);
   }
-  return -1;
+  release(&p->lock);
+  return 0;
 }
 
 // Copy to either a user address, or kernel address,
@@ -668,7 +1144,8 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
 
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
-// No lock to avoid wedging a stuck machine further.
+// Holds pidhash_lock, since freeproc() frees a proc
+// as soon as it is off its hash chain.
 void
 procdump(void)
 {
@@ -681,16 +1158,19 @@ procdump(void)
   };
   struct proc *p;
   char *state;
+  int i;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
-    if(p->state == UNUSED)
-      continue;
-    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-      state = states[p->state];
-    else
-      state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
-    printf("\n");
+  acquire(&pidhash_lock);
+  for(i = 0; i < NPIDHASH; i++){
+    for(p = pidhash[i]; p; p = p->pidnext){
+      if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
+        state = states[p->state];
+      else
+        state = "???";
+      printf("%d %s %s", p->pid, state, p->name);
+      printf("\n");
+    }
   }
+  release(&pidhash_lock);
 }
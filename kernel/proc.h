@@ -24,6 +24,24 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int online;                 // Has this hart finished booting?
+  int idle;                   // In scheduler()'s wfi; wakeidle() clears it
+  uint64 ugen;                // Bumped on user entry and exit; odd while in user mode
+  struct mm *umm;             // Address space of the last return to user mode
+  pagetable_t upin;           // User page table being copied through, or 0
+  uint64 kgen;                // kstackgen as of this hart's last TLB flush
+
+  // timer.c
+  struct spinlock tqlock;     // protects timers and tnext
+  struct timer *timers;       // pending timers, sorted by deadline
+  uint64 tnext;               // deadline of the first pending timer
+  uint64 slice;               // when the running process's time slice ends
+
+  // statistics, reported by cpustat()
+  uint64 ntimerintr;          // timer interrupts taken
+  uint64 nswtch;              // context switches into processes
+  uint64 idlecycles;          // mtime cycles spent waiting for interrupts
+  uint64 nmigrate;            // processes switched to that last ran elsewhere
 };
 
 extern struct cpu cpus[NCPU];
@@ -80,6 +98,16 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A user address space, shared by the threads created with clone().
+// Each thread has its own trapframe, mapped at TRAPFRAME - slot*PGSIZE.
+struct mm {
+  struct spinlock lock;
+  int ref;                     // Number of procs using this address space
+  pagetable_t pagetable;       // User page table
+  uint64 sz;                   // Size of process memory (bytes)
+  uint64 tfslots;              // Bitmap of trapframe slots in use
+};
+
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -88,18 +116,33 @@ struct proc {
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
-  struct proc *parent;         // Parent process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  uint64 cpumask;              // CPUs this process may run on
+  int lastcpu;                 // CPU it last ran on, or -1
+
+  // wait_lock must be held when using these:
+  struct proc *parent;         // Parent process
+  int thread;                  // Created by clone(); reaped by join()
+  struct proc *children;       // First child
+  struct proc *sibling;        // Next child of parent
+  struct proc **psibling;      // Link that points to this proc
+
+  struct proc *pidnext;        // Next in pid hash chain; pidhash_lock
+  struct proc *rqnext;         // Next on run queue; runq.lock
+  struct proc *sqnext;         // Next on sleep queue; its lock
+  struct proc **sqpprev;       // Link that points to this proc, or 0
 
   // these are private to the process, so p->lock need not be held.
-  uint64 kstack;               // Virtual address of kernel stack 内核栈
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table   页表
+  uint64 kstack;               // Kernel address of kernel stack 内核栈
+  struct mm *mm;               // Address space, possibly shared
+  pagetable_t pagetable;       // User page table, mm->pagetable   页表
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // User virtual address of trapframe
   struct context context;      // swtch() here to run process
+  void (*kfn)(void);           // Body of a kernel thread, or 0
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
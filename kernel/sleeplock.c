@@ -8,6 +8,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "sleeplock.h"
+#include "lockstat.h"
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
@@ -15,31 +16,128 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->wwait = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->cpu = 0;
+  lk->stat = lockstat_register(name, LS_SLEEP);
 }
 
+// Is lk's holder running on the CPU it acquired lk on?
+// Reads lk without lk->lk, so the answer may be stale.
+static int
+holderrunning(struct sleeplock *lk)
+{
+  struct cpu *c = *(struct cpu * volatile *)&lk->cpu;
+
+  return c != 0 && *(struct proc * volatile *)&c->proc == lk->owner;
+}
+
+// lk->lk is held and lk is held exclusively: spin for a while
+// if the holder is running, since it is likely to release lk
+// soon, before paying for a context switch.
+static void
+spinwait(struct sleeplock *lk, uint64 t0)
+{
+  release(&lk->lk);
+  while(*(volatile uint*)&lk->locked && holderrunning(lk) &&
+        r_cycle() - t0 < SLEEPLOCK_SPIN)
+    ;
+  acquire(&lk->lk);
+}
+
+// Acquire lk exclusively.
 void
 acquiresleep(struct sleeplock *lk)
 {
+  int contended, slept;
+  uint64 t0 = 0;
+
   acquire(&lk->lk);
-  while (lk->locked) {
+  contended = lk->locked || lk->readers;
+  slept = 0;
+  if(contended){
+    t0 = r_cycle();
+    if(lk->locked)
+      spinwait(lk, t0);
+  }
+  lk->wwait++;
+  while (lk->locked || lk->readers) {
+    slept = 1;
     sleep(lk, &lk->lk);
   }
+  lk->wwait--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->owner = myproc();
+  lk->cpu = mycpu();
+  lk->start = r_cycle();
   release(&lk->lk);
+  if(lk->stat){
+    lockstat_acquired(lk->stat, contended, lk->start - t0);
+    if(contended)
+      lockstat_waited(lk->stat, slept);
+  }
 }
 
 void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  if(lk->stat)
+    lockstat_released(lk->stat, lk->start);
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->cpu = 0;
   wakeup(lk);
   release(&lk->lk);
 }
 
+// Acquire lk shared with other readers. Waits while lk is
+// held exclusively, or while a process is waiting to hold
+// it exclusively, so that a stream of readers cannot
+// starve it.
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  int contended, slept;
+  uint64 t0 = 0;
+
+  acquire(&lk->lk);
+  contended = lk->locked || lk->wwait;
+  slept = 0;
+  if(contended){
+    t0 = r_cycle();
+    if(lk->locked)
+      spinwait(lk, t0);
+  }
+  while (lk->locked || lk->wwait) {
+    slept = 1;
+    sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  release(&lk->lk);
+  if(lk->stat){
+    lockstat_acquired(lk->stat, contended, r_cycle() - t0);
+    if(contended)
+      lockstat_waited(lk->stat, slept);
+  }
+}
+
+void
+releasesleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers == 0)
+    panic("releasesleepshared");
+  lk->readers--;
+  if(lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
 int
 holdingsleep(struct sleeplock *lk)
 {
@@ -1,10 +1,21 @@
-// Long-term locks for processes
+// Long-term locks for processes, held either exclusively
+// or shared by any number of readers.
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  uint readers;      // Number of shared holders
+  uint wwait;        // Number waiting to hold it exclusively
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+
+  // For adaptive spinning in acquiresleep():
+  struct proc *owner; // Process holding lock
+  struct cpu *cpu;   // CPU it acquired the lock on
+
+  // For lockstat:
+  struct lockstat *stat; // Record for locks with this name, or 0.
+  uint64 start;      // r_cycle() when acquired.
 };
 
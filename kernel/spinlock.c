@@ -6,14 +6,173 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "proc.h"
+#include "lockstat.h"
 #include "defs.h"
 
+#if defined(LOCK_TICKET)
+
+// Ticket lock: each acquirer takes the next ticket and
+// spins until the lock's owner field reaches it, so the
+// lock is granted in FIFO order and a release is a plain
+// increment rather than a swap that every waiter retries.
+
+static void
+lock_init(struct spinlock *lk)
+{
+  lk->next = 0;
+  lk->owner = 0;
+}
+
+// Spin until lk is ours. Returns 1, and sets *t0 to the
+// cycle count at which waiting began, if lk was held.
+static int
+lock_take(struct spinlock *lk, uint64 *t0)
+{
+  uint t;
+
+  // amoadd.w hands out tickets atomically.
+  t = __sync_fetch_and_add(&lk->next, 1);
+  if(*(volatile uint*)&lk->owner == t)
+    return 0;
+  *t0 = r_cycle();
+  while(*(volatile uint*)&lk->owner != t)
+    ;
+  return 1;
+}
+
+static void
+lock_drop(struct spinlock *lk)
+{
+  __sync_fetch_and_add(&lk->owner, 1);
+}
+
+#elif defined(LOCK_MCS)
+
+// MCS queue lock: each waiter spins on a flag in its own
+// queue node, and the holder hands the lock to the next
+// node in line, so a release touches one waiter's cache
+// line instead of all of them. Nodes come from a small
+// per-CPU pool, since a CPU may hold several locks at once
+// and does not always release them in the reverse order.
+// Interrupts are off while a CPU holds or waits for a lock,
+// so the pool needs no lock of its own.
+
+#define NMCS 16  // spinlocks one CPU may hold at once
+
+struct mcsnode {
+  struct mcsnode *next;  // next waiter
+  int locked;            // waiter spins while set
+  int busy;              // in use by this CPU
+} __attribute__ ((aligned (64)));
+
+static struct mcsnode mcsnodes[NCPU][NMCS];
+
+static void
+lock_init(struct spinlock *lk)
+{
+  lk->tail = 0;
+  lk->node = 0;
+}
+
+// Spin until lk is ours. Returns 1, and sets *t0 to the
+// cycle count at which waiting began, if lk was held.
+static int
+lock_take(struct spinlock *lk, uint64 *t0)
+{
+  struct mcsnode *n, *prev;
+
+  for(n = mcsnodes[cpuid()]; n < &mcsnodes[cpuid()][NMCS]; n++)
+    if(!n->busy)
+      break;
+  if(n == &mcsnodes[cpuid()][NMCS])
+    panic("acquire: too many locks held");
+  n->busy = 1;
+  n->next = 0;
+  n->locked = 1;
+  __sync_synchronize();
+
+  // join the queue; amoswap.d returns the previous tail.
+  prev = __sync_lock_test_and_set(&lk->tail, n);
+  if(prev){
+    *t0 = r_cycle();
+    *(struct mcsnode * volatile *)&prev->next = n;
+    while(*(volatile int*)&n->locked)
+      ;
+  }
+  lk->node = n;
+  return prev != 0;
+}
+
+static void
+lock_drop(struct spinlock *lk)
+{
+  struct mcsnode *n, *next;
+
+  n = lk->node;
+  lk->node = 0;
+  next = *(struct mcsnode * volatile *)&n->next;
+  if(next == 0){
+    // no one queued behind us yet: free the lock, unless
+    // a new waiter swaps itself in first.
+    if(__sync_val_compare_and_swap(&lk->tail, n, 0) == n){
+      n->busy = 0;
+      return;
+    }
+    // it has joined but not yet linked itself to us.
+    while((next = *(struct mcsnode * volatile *)&n->next) == 0)
+      ;
+  }
+  *(volatile int*)&next->locked = 0;
+  n->busy = 0;
+}
+
+#else
+
+static void
+lock_init(struct spinlock *lk)
+{
+  lk->locked = 0;
+}
+
+// Spin until lk is ours. Returns 1, and sets *t0 to the
+// cycle count at which waiting began, if lk was held.
+static int
+lock_take(struct spinlock *lk, uint64 *t0)
+{
+  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+  //   a5 = 1
+  //   s1 = &lk->locked
+  //   amoswap.w.aq a5, a5, (s1)
+  if(__sync_lock_test_and_set(&lk->locked, 1) == 0)
+    return 0;
+  *t0 = r_cycle();
+  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+    ;
+  return 1;
+}
+
+static void
+lock_drop(struct spinlock *lk)
+{
+  // Release the lock, equivalent to lk->locked = 0.
+  // This code doesn't use a C assignment, since the C standard
+  // implies that an assignment might be implemented with
+  // multiple store instructions.
+  // On RISC-V, sync_lock_release turns into an atomic swap:
+  //   s1 = &lk->locked
+  //   amoswap.w zero, zero, (s1)
+  __sync_lock_release(&lk->locked);
+}
+
+#endif
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lock_init(lk);
   lk->cpu = 0;
+  lk->stat = lockstat_register(name, LS_SPIN);
 }
 
 // Acquire the lock.
@@ -21,16 +180,14 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  int contended;
+  uint64 t0 = 0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  contended = lock_take(lk, &t0);
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +197,10 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+
+  lk->start = r_cycle();
+  if(lk->stat)
+    lockstat_acquired(lk->stat, contended, lk->start - t0);
 }
 
 // Release the lock.
@@ -49,6 +210,9 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  if(lk->stat)
+    lockstat_released(lk->stat, lk->start);
+
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,14 +223,7 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  lock_drop(lk);
 
   pop_off();
 }
@@ -77,7 +234,9 @@ int
 holding(struct spinlock *lk)
 {
   int r;
-  r = (lk->locked && lk->cpu == mycpu());
+  // only this cpu sets lk->cpu to itself, and it is
+  // cleared before the lock is released.
+  r = (lk->cpu == mycpu());
   return r;
 }
 
@@ -1,9 +1,23 @@
 // Mutual exclusion lock.
+// A test-and-set lock by default; a ticket lock if built
+// with LOCK_TICKET, or an MCS queue lock with LOCK_MCS.
 struct spinlock {
+#if defined(LOCK_TICKET)
+  uint next;         // Next ticket to hand out.
+  uint owner;        // Ticket allowed to hold the lock.
+#elif defined(LOCK_MCS)
+  struct mcsnode *tail;  // Last queued CPU's node; 0 if free.
+  struct mcsnode *node;  // Holder's node.
+#else
   uint locked;       // Is the lock held?
+#endif
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For lockstat:
+  struct lockstat *stat; // Record for locks with this name, or 0.
+  uint64 start;      // r_cycle() when acquired.
 };
 
@@ -49,8 +49,8 @@ start()
   asm volatile("mret");
 }
 
-// set up to receive timer interrupts in machine mode,
-// which arrive at timervec in kernelvec.S,
+// set up to receive timer and inter-processor interrupts
+// in machine mode, which arrive at timervec in kernelvec.S,
 // which turns them into software interrupts for
 // devintr() in trap.c.
 void
@@ -59,25 +59,31 @@ timerinit()
   // each CPU has a separate source of timer interrupts.
   int id = r_mhartid();
 
-  // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
-  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+  // no deadline yet; the kernel programs mtimecmp
+  // itself (see timer.c) once it has something to run.
+  *(uint64*)CLINT_MTIMECMP(id) = -1;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..3] : space for timervec to save registers.
   // scratch[4] : address of CLINT MTIMECMP register.
-  // scratch[5] : desired interval (in cycles) between timer interrupts.
+  // scratch[6] : address of CLINT MSIP register.
+  // scratch[7] : set by timervec when mtimecmp fires.
   uint64 *scratch = &mscratch0[32 * id];
   scratch[4] = CLINT_MTIMECMP(id);
-  scratch[5] = interval;
+  scratch[6] = CLINT_MSIP(id);
   w_mscratch((uint64)scratch);
 
+  // let supervisor mode read the cycle and time CSRs.
+  w_mcounteren(r_mcounteren() | 3);
+
   // set the machine-mode trap handler.
   w_mtvec((uint64)timervec);
 
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer interrupts, and software
+  // interrupts for the inter-processor interrupts sent by
+  // tlbshootdown() and wakeidle().
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
 }
@@ -20,3 +20,18 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_nsleep 22
+#define SYS_uptimens 23
+#define SYS_cpustat 24
+#define SYS_clone  25
+#define SYS_join   26
+#define SYS_futex_wait 27
+#define SYS_futex_wake 28
+#define SYS_setaffinity 29
+#define SYS_getaffinity 30
+#define SYS_uring_enter 31
+#define SYS_poll   32
+#define SYS_fcntl  33
+#define SYS_splice 34
+#define SYS_fsync  35
+#define SYS_bcachestat 36
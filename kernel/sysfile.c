@@ -15,6 +15,21 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uring.h"
+#include "bcachestat.h"
+
+// Return the struct file for descriptor fd in *pf.
+static int
+fdfile(int fd, struct file **pf)
+{
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+    return -1;
+  if(pf)
+    *pf = f;
+  return 0;
+}
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -22,16 +37,13 @@ static int
 argfd(int n, int *pfd, struct file **pf)
 {
   int fd;
-  struct file *f;
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fdfile(fd, pf) < 0)
     return -1;
   if(pfd)
     *pfd = fd;
-  if(pf)
-    *pf = f;
   return 0;
 }
 
@@ -218,6 +230,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcache_enter(dp, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -258,7 +271,7 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0)
     panic("create: ialloc");
 
   ilock(ip);
@@ -275,28 +288,56 @@ create(char *path, short type, short major, short minor)
       panic("create dots");
   }
 
-  if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+  // an indexed directory can be full, or have a leaf
+  // whose names all share one hash.
+  if(dirlink(dp, name, ip->inum) < 0){
+    if(type == T_DIR){
+      dp->nlink--;
+      iupdate(dp);
+    }
+    ip->nlink = 0;
+    iupdate(ip);
+    iunlockput(ip);
+    iunlockput(dp);
+    return 0;
+  }
 
   iunlockput(dp);
 
   return ip;
 }
 
-uint64
-sys_open(void)
+// Lock ip shared if shared is set, else exclusively.
+static void
+ilockas(struct inode *ip, int shared)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  if(shared)
+    ilockshared(ip);
+  else
+    ilock(ip);
+}
+
+static void
+iunlockas(struct inode *ip, int shared)
+{
+  if(shared)
+    iunlockshared(ip);
+  else
+    iunlock(ip);
+}
+
+// Open path with mode omode and return a new descriptor for it.
+static int
+openpath(char *path, int omode)
+{
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
-    return -1;
+  int shared;
 
   begin_op();
 
+  shared = 0;
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
@@ -308,16 +349,20 @@ sys_open(void)
       end_op();
       return -1;
     }
-    ilock(ip);
+    // unless it truncates, open only reads the inode.
+    shared = (omode & O_TRUNC) == 0;
+    ilockas(ip, shared);
     if(ip->type == T_DIR && omode != O_RDONLY){
-      iunlockput(ip);
+      iunlockas(ip, shared);
+      iput(ip);
       end_op();
       return -1;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
-    iunlockput(ip);
+    iunlockas(ip, shared);
+    iput(ip);
     end_op();
     return -1;
   }
@@ -325,7 +370,8 @@ sys_open(void)
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
-    iunlockput(ip);
+    iunlockas(ip, shared);
+    iput(ip);
     end_op();
     return -1;
   }
@@ -345,12 +391,23 @@ sys_open(void)
     itrunc(ip);
   }
 
-  iunlock(ip);
+  iunlockas(ip, shared);
   end_op();
 
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
+    return -1;
+  return openpath(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -454,6 +511,87 @@ sys_exec(void)
   return -1;
 }
 
+// Wait for any of several descriptors to be ready.
+uint64
+sys_poll(void)
+{
+  uint64 fds;
+  int nfds, timeout;
+
+  if(argaddr(0, &fds) < 0 || argint(1, &nfds) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  return poll(fds, nfds, timeout);
+}
+
+// Get or set a property of an open file.
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  switch(cmd){
+  case F_GETPIPESZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipegetsize(f->pipe);
+  case F_SETPIPESZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipesetsize(f->pipe, arg);
+  }
+  return -1;
+}
+
+// Move data from one descriptor to another in the kernel.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+// Wait until the last change to a file is on disk. A file's
+// data is written in place as it is written, so this waits
+// only for the log transaction holding the file's i-node.
+// Directory blocks change without the i-node, so a directory
+// waits for the open transaction.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+  int tid;
+
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  tid = f->ip->type == T_DIR ? log_tid() : f->ip->tid;
+  iunlock(f->ip);
+  log_force(tid);
+  return 0;
+}
+
+// copy buffer cache statistics to user address addr.
+uint64
+sys_bcachestat(void)
+{
+  uint64 addr;
+  struct bcachestat st;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  bstat(&st);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
 uint64
 sys_pipe(void)
 {
@@ -484,3 +622,82 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// Run one uring request and return its result.
+static int
+uring_op(struct sqe *e)
+{
+  char path[MAXPATH];
+  struct file *f;
+
+  if(e->op == URING_OPEN){
+    if(fetchstr(e->addr, path, MAXPATH) < 0)
+      return -1;
+    return openpath(path, e->n);
+  }
+  if(fdfile(e->fd, &f) < 0)
+    return -1;
+  switch(e->op){
+  case URING_READ:
+    if(e->n < 0)
+      return -1;
+    return fileread(f, e->addr, e->n);
+  case URING_WRITE:
+    if(e->n < 0)
+      return -1;
+    return filewrite(f, e->addr, e->n);
+  case URING_CLOSE:
+    myproc()->ofile[e->fd] = 0;
+    fileclose(f);
+    return 0;
+  case URING_FSTAT:
+    return filestat(f, e->addr);
+  }
+  return -1;
+}
+
+#define RINGOFF(field) ((uint64)&((struct uring*)0)->field)
+
+// Run the requests queued on the submission ring at
+// user address ring, as many as fit on the completion
+// ring, and return how many ran.
+uint64
+sys_uring_enter(void)
+{
+  uint64 ring;
+  uint sqhead, sqtail, cqhead, cqtail;
+  struct sqe e;
+  struct cqe c;
+  struct proc *p = myproc();
+  int n;
+
+  if(argaddr(0, &ring) < 0)
+    return -1;
+  if(copyin(p->pagetable, (char*)&sqhead, ring + RINGOFF(sqhead), sizeof(uint)) < 0 ||
+     copyin(p->pagetable, (char*)&sqtail, ring + RINGOFF(sqtail), sizeof(uint)) < 0 ||
+     copyin(p->pagetable, (char*)&cqhead, ring + RINGOFF(cqhead), sizeof(uint)) < 0 ||
+     copyin(p->pagetable, (char*)&cqtail, ring + RINGOFF(cqtail), sizeof(uint)) < 0)
+    return -1;
+  if(sqtail - sqhead > URING_SIZE || cqtail - cqhead > URING_SIZE)
+    return -1;
+
+  n = 0;
+  while(sqhead != sqtail && cqtail - cqhead < URING_SIZE && !p->killed){
+    if(copyin(p->pagetable, (char*)&e,
+              ring + RINGOFF(sq[sqhead % URING_SIZE]), sizeof(e)) < 0)
+      break;
+    c.data = e.data;
+    c.res = uring_op(&e);
+    if(copyout(p->pagetable, ring + RINGOFF(cq[cqtail % URING_SIZE]),
+               (char*)&c, sizeof(c)) < 0)
+      break;
+    sqhead++;
+    cqtail++;
+    n++;
+  }
+
+  if(copyout(p->pagetable, ring + RINGOFF(sqhead), (char*)&sqhead, sizeof(uint)) < 0 ||
+     copyout(p->pagetable, ring + RINGOFF(cqtail), (char*)&cqtail, sizeof(uint)) < 0)
+    return -1;
+  return n;
+}
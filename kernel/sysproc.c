@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "timer.h"
+#include "cpustat.h"
 
 uint64
 sys_exit(void)
@@ -38,6 +40,70 @@ sys_wait(void)
   return wait(p);
 }
 
+uint64
+sys_setaffinity(void)
+{
+  int pid;
+  uint64 mask;
+
+  if(argint(0, &pid) < 0 || argaddr(1, &mask) < 0)
+    return -1;
+  return setaffinity(pid, mask);
+}
+
+uint64
+sys_getaffinity(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return 0;
+  return getaffinity(pid);
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futex_wait(addr, val);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futex_wake(addr, n);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  if(argint(0, &tid) < 0 || argaddr(1, &p) < 0)
+    return -1;
+  return join(tid, p);
+}
+
 uint64
 sys_sbrk(void)
 {
@@ -46,7 +112,7 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
+  addr = myproc()->mm->sz;
   if(growproc(n) < 0)
     return -1;
   return addr;
@@ -56,21 +122,31 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  if(n <= 0)
+    return 0;
+  return tick_sleep(n);
+}
+
+// sleep for at least the given number of nanoseconds.
+uint64
+sys_nsleep(void)
+{
+  uint64 ns, now, n;
+
+  if(argaddr(0, &ns) < 0)
+    return -1;
+  if(ns == 0)
+    return 0;
+  // round up without NS2CYCLES(), which wraps for huge ns,
+  // and sleep until killed if the deadline would wrap too.
+  now = r_time();
+  n = ns / CYCLES2NS(1) + (ns % CYCLES2NS(1) != 0);
+  if(n >= TIMER_NEVER - now)
+    return timer_sleep(TIMER_NEVER);
+  return timer_sleep(now + n);
 }
 
 uint64
@@ -83,15 +159,40 @@ sys_kill(void)
   return kill(pid);
 }
 
-// return how many clock tick interrupts have occurred
+// return how many clock ticks have elapsed
 // since start.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
+  return r_time() / TICKCYCLES;
+}
+
+// return nanoseconds since start.
+uint64
+sys_uptimens(void)
+{
+  return CYCLES2NS(r_time());
+}
+
+// copy per-CPU statistics for cpu to user address addr.
+uint64
+sys_cpustat(void)
+{
+  int id;
+  uint64 addr;
+  struct cpu *c;
+  struct cpustat st;
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  if(argint(0, &id) < 0 || argaddr(1, &addr) < 0)
+    return -1;
+  if(id < 0 || id >= NCPU || !cpus[id].online)
+    return -1;
+  c = &cpus[id];
+  st.timerintr = c->ntimerintr;
+  st.nswtch = c->nswtch;
+  st.idle = CYCLES2NS(c->idlecycles);
+  st.nmigrate = c->nmigrate;
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
 }
@@ -0,0 +1,400 @@
+//
+// One-shot timers.
+//
+// Each CPU keeps a queue of pending timers sorted by deadline,
+// and a hierarchical timer wheel for timers that only need
+// clock-tick resolution, such as sleep(). Adding a timer to the
+// wheel and expiring it are constant time, so many sleeping
+// processes cost nothing until their own tick comes around.
+//
+// A hart programs its CLINT mtimecmp for the earliest of its
+// first queued deadline, its next wheel event, and the end of
+// the running process's time slice, so an idle hart is not
+// interrupted until something is actually due. timervec in
+// kernelvec.S disarms mtimecmp when it fires and forwards the
+// interrupt to timerintr() as a supervisor software interrupt.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "timer.h"
+#include "defs.h"
+
+// Level l slot i holds timers that expire within the
+// TW_SIZE^l ticks starting at the l'th digit of the tick
+// number (base TW_SIZE) being i, and that are too far
+// from clk to fit in a lower level. Each time clk crosses
+// a level l boundary, the slot it enters is cascaded down
+// into the levels below.
+struct wheel {
+  uint64 clk;                            // next tick to process
+  uint64 map[TW_LEVELS];                 // bit i set if slot[l][i] non-empty
+  struct timer *slot[TW_LEVELS][TW_SIZE];
+};
+
+// protected by cpus[i].tqlock.
+static struct wheel wheels[NCPU];
+
+extern uint64 mscratch0[];  // start.c
+
+static uint64
+curtick(void)
+{
+  return r_time() / TICKCYCLES;
+}
+
+// index of the lowest set bit in x, which must be non-zero.
+static int
+lowbit(uint64 x)
+{
+  int n = 0;
+
+  if((x & 0xffffffff) == 0){ n += 32; x >>= 32; }
+  if((x & 0xffff) == 0){ n += 16; x >>= 16; }
+  if((x & 0xff) == 0){ n += 8; x >>= 8; }
+  if((x & 0xf) == 0){ n += 4; x >>= 4; }
+  if((x & 0x3) == 0){ n += 2; x >>= 2; }
+  if((x & 0x1) == 0){ n += 1; }
+  return n;
+}
+
+// distance from slot pos to the first non-empty slot
+// at or after it, wrapping around.
+static int
+nextslot(uint64 map, int pos)
+{
+  if(pos)
+    map = (map >> pos) | (map << (TW_SIZE - pos));
+  return lowbit(map);
+}
+
+// The next tick at which the wheel has work to do:
+// a level 0 slot to expire or a higher slot to cascade.
+static uint64
+wheel_next(struct wheel *w)
+{
+  uint64 next, b, t;
+  int l;
+
+  next = TIMER_NEVER;
+  for(l = 0; l < TW_LEVELS; l++){
+    if(w->map[l] == 0)
+      continue;
+    // b is the first level l boundary not yet processed.
+    b = (w->clk + (1UL << (l*TW_BITS)) - 1) >> (l*TW_BITS);
+    t = (b + nextslot(w->map[l], b % TW_SIZE)) << (l*TW_BITS);
+    if(t < next)
+      next = t;
+  }
+  return next;
+}
+
+// Recompute c's earliest deadline.
+// Caller must hold c->tqlock.
+static void
+tq_update(struct cpu *c)
+{
+  uint64 next;
+
+  next = wheel_next(&wheels[c - cpus]);
+  if(next != TIMER_NEVER)
+    next *= TICKCYCLES;
+  if(c->timers && c->timers->expires < next)
+    next = c->timers->expires;
+  c->tnext = next;
+}
+
+static void
+list_insert(struct timer **pp, struct timer *t)
+{
+  t->next = *pp;
+  t->pprev = pp;
+  if(*pp)
+    (*pp)->pprev = &t->next;
+  *pp = t;
+}
+
+// Place t in the wheel according to its distance from w->clk.
+static void
+wheel_insert(struct wheel *w, struct timer *t)
+{
+  uint64 e, delta;
+  int l, i;
+
+  e = t->expires;
+  if(e < w->clk)
+    e = w->clk;
+  delta = e - w->clk;
+  for(l = 0; l < TW_LEVELS-1; l++)
+    if(delta < (1UL << ((l+1)*TW_BITS)))
+      break;
+  if(delta >= (1UL << (TW_LEVELS*TW_BITS)))
+    e = w->clk + (1UL << (TW_LEVELS*TW_BITS)) - 1;  // re-cascaded until due
+  i = (e >> (l*TW_BITS)) % TW_SIZE;
+  t->slot = l*TW_SIZE + i;
+  list_insert(&w->slot[l][i], t);
+  w->map[l] |= 1UL << i;
+}
+
+// Process tick w->clk: cascade the higher slots it enters,
+// then run the timers expiring in it.
+static void
+wheel_tick(struct wheel *w)
+{
+  struct timer *t, *list;
+  int l, i;
+
+  for(l = 1; l < TW_LEVELS; l++){
+    if(w->clk & ((1UL << (l*TW_BITS)) - 1))
+      break;
+    i = (w->clk >> (l*TW_BITS)) % TW_SIZE;
+    list = w->slot[l][i];
+    w->slot[l][i] = 0;
+    w->map[l] &= ~(1UL << i);
+    while((t = list) != 0){
+      list = t->next;
+      wheel_insert(w, t);
+    }
+  }
+
+  i = w->clk % TW_SIZE;
+  list = w->slot[0][i];
+  w->slot[0][i] = 0;
+  w->map[0] &= ~(1UL << i);
+  while((t = list) != 0){
+    list = t->next;
+    t->cpu = -1;
+    t->fn(t);
+  }
+  w->clk++;
+}
+
+void
+tqinit(void)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    initlock(&c->tqlock, "timerq");
+    c->timers = 0;
+    c->tnext = TIMER_NEVER;
+    c->slice = TIMER_NEVER;
+    wheels[c - cpus].clk = curtick();
+  }
+}
+
+// Program this hart's mtimecmp for its next deadline.
+// Interrupts must be disabled.
+// Reads c->tnext without c->tqlock: another CPU can only
+// delete timers from this queue, which at worst leaves the
+// deadline early and costs a spurious timerintr().
+void
+timer_program(void)
+{
+  struct cpu *c = mycpu();
+  uint64 when;
+
+  when = c->tnext;
+  if(c->slice < when)
+    when = c->slice;
+  *(uint64*)CLINT_MTIMECMP(cpuid()) = when;
+}
+
+// Unlink t from its queue or wheel slot.
+// Caller must hold the queue's tqlock.
+static void
+tq_remove(struct timer *t)
+{
+  struct cpu *c = &cpus[t->cpu];
+  struct wheel *w = &wheels[t->cpu];
+
+  if(t->next)
+    t->next->pprev = t->pprev;
+  *t->pprev = t->next;
+  if(t->slot >= 0 && w->slot[t->slot / TW_SIZE][t->slot % TW_SIZE] == 0)
+    w->map[t->slot / TW_SIZE] &= ~(1UL << (t->slot % TW_SIZE));
+  t->cpu = -1;
+  tq_update(c);
+}
+
+// Queue t on this CPU to call t->fn once mtime reaches t->expires.
+void
+timer_add(struct timer *t)
+{
+  struct cpu *c;
+  struct timer **pp;
+
+  push_off();
+  c = mycpu();
+  acquire(&c->tqlock);
+  for(pp = &c->timers; *pp && (*pp)->expires <= t->expires; pp = &(*pp)->next)
+    ;
+  t->cpu = t->qcpu = c - cpus;
+  t->slot = -1;
+  list_insert(pp, t);
+  tq_update(c);
+  release(&c->tqlock);
+  timer_program();
+  pop_off();
+}
+
+// Queue t on this CPU's wheel to call t->fn at
+// clock tick t->expires.
+void
+wheel_add(struct timer *t)
+{
+  struct cpu *c;
+  struct wheel *w;
+  int l;
+
+  push_off();
+  c = mycpu();
+  w = &wheels[c - cpus];
+  acquire(&c->tqlock);
+  // an empty wheel has nothing left to cascade,
+  // so it can skip straight to the present.
+  for(l = 0; l < TW_LEVELS && w->map[l] == 0; l++)
+    ;
+  if(l == TW_LEVELS && w->clk < curtick())
+    w->clk = curtick();
+  t->cpu = t->qcpu = c - cpus;
+  wheel_insert(w, t);
+  tq_update(c);
+  release(&c->tqlock);
+  timer_program();
+  pop_off();
+}
+
+// Cancel t, which must have been added, if it has not
+// fired yet. Returns 1 if t was still pending.
+// t->cpu is cleared just before t->fn is called, but t->fn
+// runs with the queue lock held, so taking that lock, even
+// when t is no longer queued, waits for a t->fn running on
+// another hart. t->fn is not running once timer_del() returns.
+int
+timer_del(struct timer *t)
+{
+  struct spinlock *lk;
+  int pending;
+
+  // t->qcpu does not change, since a timer is
+  // re-armed only by its owner, which is calling us.
+  lk = &cpus[t->qcpu].tqlock;
+  acquire(lk);
+  pending = t->cpu >= 0;
+  if(pending)
+    tq_remove(t);
+  release(lk);
+  return pending;
+}
+
+// Has this hart's mtimecmp fired since the last call?
+// timervec raises the same software interrupt for the
+// timer and for IPIs, and sets scratch[7] only for the
+// timer. Interrupts must be disabled.
+int
+timerfired(void)
+{
+  return __sync_lock_test_and_set(&mscratch0[32 * cpuid() + 7], 0) != 0;
+}
+
+// Called on a hart when its mtimecmp fires.
+// Runs expired timers, re-programs the hart, and
+// returns 1 if the running process's time slice is used up.
+int
+timerintr(void)
+{
+  struct cpu *c = mycpu();
+  struct wheel *w = &wheels[c - cpus];
+  struct timer *t;
+  uint64 now, tick, next;
+  int expired;
+
+  c->ntimerintr++;
+  now = r_time();
+  tick = now / TICKCYCLES;
+
+  acquire(&c->tqlock);
+  while((t = c->timers) != 0 && t->expires <= now){
+    tq_remove(t);
+    t->fn(t);
+  }
+  // skip ticks on which the wheel has nothing to do.
+  while((next = wheel_next(w)) <= tick){
+    w->clk = next;
+    wheel_tick(w);
+  }
+  if(w->clk < tick)
+    w->clk = tick;
+  tq_update(c);
+  release(&c->tqlock);
+
+  expired = c->slice <= now;
+  if(expired)
+    c->slice = now + TICKCYCLES;
+  timer_program();
+  return expired;
+}
+
+static void
+timer_wakeup(struct timer *t)
+{
+  wakeproc(t->arg, t);
+}
+
+// Arm t with add() and sleep until it fires.
+// Returns -1 if the process was killed first.
+static int
+timer_wait(struct timer *t, void (*add)(struct timer*))
+{
+  struct spinlock *lk;
+
+  t->fn = timer_wakeup;
+  t->arg = myproc();
+
+  // t can only fire on this hart, so with interrupts off
+  // it is still queued when we take its queue's lock.
+  // t->fn runs with that lock held, so checking t->cpu
+  // under it cannot miss the wakeup.
+  push_off();
+  add(t);
+  lk = &cpus[t->cpu].tqlock;
+  acquire(lk);
+  pop_off();
+  while(t->cpu >= 0){
+    if(myproc()->killed){
+      tq_remove(t);
+      release(lk);
+      return -1;
+    }
+    sleep(t, lk);
+  }
+  release(lk);
+  return 0;
+}
+
+// Sleep until mtime reaches expires.
+// Returns -1 if the process was killed first.
+int
+timer_sleep(uint64 expires)
+{
+  struct timer t;
+
+  t.expires = expires;
+  return timer_wait(&t, timer_add);
+}
+
+// Sleep for n clock ticks.
+// Returns -1 if the process was killed first.
+int
+tick_sleep(int n)
+{
+  struct timer t;
+
+  t.expires = curtick() + n;
+  return timer_wait(&t, wheel_add);
+}
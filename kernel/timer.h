@@ -0,0 +1,26 @@
+// One-shot timer, queued on the CPU that armed it.
+// timer_add() timers expire at an mtime cycle;
+// wheel_add() timers expire at a clock tick.
+struct timer {
+  uint64 expires;            // absolute deadline, in cycles or ticks
+  void (*fn)(struct timer*); // called with the queue lock held
+  void *arg;                 // for fn's use
+  int cpu;                   // queue holding this timer, or -1
+  int qcpu;                  // queue that last held it, for timer_del()
+  int slot;                  // wheel level*TW_SIZE+index, or -1
+
+  struct timer *next;        // deadline-sorted queue or wheel slot
+  struct timer **pprev;
+};
+
+#define TIMER_NEVER (~0UL)
+
+// timer wheel geometry: TW_LEVELS levels of TW_SIZE slots,
+// each level TW_SIZE times coarser than the one below.
+#define TW_BITS   6
+#define TW_SIZE   (1 << TW_BITS)
+#define TW_LEVELS 4
+
+// mtime cycles per nanosecond-denominated unit.
+#define NS2CYCLES(ns) (((ns) + (1000000000L/CLINT_HZ) - 1) / (1000000000L/CLINT_HZ))
+#define CYCLES2NS(c)  ((c) * (1000000000L/CLINT_HZ))
@@ -6,9 +6,6 @@
 #include "proc.h"
 #include "defs.h"
 
-struct spinlock tickslock;
-uint ticks;
-
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -19,7 +16,7 @@ extern int devintr();
 void
 trapinit(void)
 {
-  initlock(&tickslock, "time");
+  tqinit();
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -45,6 +42,10 @@ usertrap(void)
   // since we're now in the kernel.
   w_stvec((uint64)kernelvec);
 
+  // uservec has switched to the kernel page table,
+  // so tlbshootdown() need not wait for this hart.
+  mycpu()->ugen++;
+
   struct proc *p = myproc();
   
   // save user program counter.
@@ -121,11 +122,18 @@ usertrapret(void)
   // tell trampoline.S the user page table to switch to.
   uint64 satp = MAKE_SATP(p->pagetable);
 
+  // from here until the next usertrap(), tlbshootdown()
+  // must interrupt this hart to flush its TLB.
+  struct cpu *c = mycpu();
+  c->umm = p->mm;
+  c->ugen++;
+  __sync_synchronize();
+
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->tfva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -159,19 +167,10 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
-void
-clockintr()
-{
-  acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
-  release(&tickslock);
-}
-
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
-// 1 if other device,
+// returns 2 if the running process's time slice is up,
+// 1 if other device or timer,
 // 0 if not recognized.
 int
 devintr()
@@ -201,18 +200,21 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or IPI, forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
+    // the SSIP bit in sip, before timerintr() re-arms
+    // the timer so that a new interrupt is not lost.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    // an IPI needs nothing but the trap itself: it only
+    // wakes an idle hart or makes a user hart flush its TLB.
+    if(!timerfired())
+      return 1;
+    if(timerintr())
+      return 2;
+    return 1;
   } else {
     return 0;
   }
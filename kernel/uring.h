@@ -0,0 +1,38 @@
+// Submission and completion rings for uring_enter().
+// The rings live in user memory. User code fills sq[sqtail %
+// URING_SIZE] and advances sqtail; uring_enter() runs the
+// requests from sqhead up to sqtail in order, posting one
+// completion each at cq[cqtail % URING_SIZE], for user code
+// to consume from cqhead. The kernel writes only sqhead and
+// cqtail, and user code only sqtail and cqhead.
+
+#define URING_SIZE 32   // entries in each ring
+
+// request operations
+#define URING_READ   1  // read(fd, addr, n)
+#define URING_WRITE  2  // write(fd, addr, n)
+#define URING_OPEN   3  // open(addr, n)
+#define URING_CLOSE  4  // close(fd)
+#define URING_FSTAT  5  // fstat(fd, addr)
+
+struct sqe {
+  int op;             // URING_*
+  int fd;
+  uint64 addr;        // buffer, path, or struct stat
+  int n;              // byte count, or open mode
+  uint64 data;        // copied to the completion
+};
+
+struct cqe {
+  uint64 data;        // from the request
+  int res;            // what the system call would return
+};
+
+struct uring {
+  uint sqhead;
+  uint sqtail;
+  uint cqhead;
+  uint cqtail;
+  struct sqe sq[URING_SIZE];
+  struct cqe cq[URING_SIZE];
+};
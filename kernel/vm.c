@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -11,6 +13,15 @@
  */
 pagetable_t kernel_pagetable;
 
+// Kernel stack slots, KSTACK(0) to KSTACK(nkstack-1) have
+// been handed out; the free ones are on kstackfreelist.
+// kstackgen counts slots unmapped by kstackfree().
+struct spinlock kstack_lock;
+static int kstackfreelist[NKSTACK];
+static int nkfree;
+static int nkstack;
+uint64 kstackgen;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
@@ -45,6 +56,8 @@ kvminit()
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
   kvmmap(TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
+
+  initlock(&kstack_lock, "kstack");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -121,6 +134,70 @@ kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
     panic("kvmmap");
 }
 
+// Allocate a page for a kernel stack and map it at a free
+// KSTACK() slot, with the unmapped page below it as a guard
+// against overflow. Returns the stack's lowest address,
+// or 0 if out of memory.
+uint64
+kstackalloc(void)
+{
+  char *pa;
+  uint64 va;
+  int i;
+
+  if((pa = kalloc()) == 0)
+    return 0;
+  acquire(&kstack_lock);
+  if(nkfree > 0)
+    i = kstackfreelist[--nkfree];
+  else if(nkstack < NKSTACK)
+    i = nkstack++;
+  else
+    goto bad;
+  va = KSTACK(i);
+  if(mappages(kernel_pagetable, va, PGSIZE, (uint64)pa, PTE_R | PTE_W) != 0){
+    kstackfreelist[nkfree++] = i;
+    goto bad;
+  }
+  release(&kstack_lock);
+  return va;
+
+bad:
+  release(&kstack_lock);
+  kfree(pa);
+  return 0;
+}
+
+// Unmap and free the kernel stack at va, and put its slot
+// back on the free list. The caller must not be running on
+// it. Other harts may still have TLB entries for va; they
+// flush them in kstacksync() before they run another
+// process, which is the only way a hart touches a stack.
+void
+kstackfree(uint64 va)
+{
+  acquire(&kstack_lock);
+  uvmunmap(kernel_pagetable, va, 1, 1);
+  kstackgen++;
+  kstackfreelist[nkfree++] = (TRAMPOLINE - va) / (2*PGSIZE) - 1;
+  release(&kstack_lock);
+}
+
+// Flush this hart's TLB if kstackfree() has unmapped a stack
+// since it last did, so that a reused slot cannot hit a
+// stale entry. Interrupts must be disabled.
+void
+kstacksync(void)
+{
+  struct cpu *c = mycpu();
+  uint64 gen = *(volatile uint64*)&kstackgen;
+
+  if(c->kgen != gen){
+    c->kgen = gen;
+    sfence_vma();
+  }
+}
+
 // translate a kernel virtual address to
 // a physical address. only needed for
 // addresses on the stack.
@@ -348,6 +425,37 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Look up the user page at va0 for copyout(), copyin() or
+// copyinstr(), and keep it from being freed until uvmunpin():
+// another thread of the address space may be shrinking it,
+// and tlbshootdown() waits while this hart has pagetable in
+// c->upin. Returns its physical address, or 0 (and unpins)
+// if it is not mapped. Interrupts stay off while pinned.
+static uint64
+uvmpin(pagetable_t pagetable, uint64 va0)
+{
+  uint64 pa;
+
+  push_off();
+  mycpu()->upin = pagetable;
+  // order the store to upin before reading the PTE;
+  // pairs with the fence in tlbshootdown().
+  __sync_synchronize();
+  if((pa = walkaddr(pagetable, va0)) == 0){
+    mycpu()->upin = 0;
+    pop_off();
+  }
+  return pa;
+}
+
+static void
+uvmunpin(void)
+{
+  __sync_synchronize();
+  mycpu()->upin = 0;
+  pop_off();
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -358,13 +466,14 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmpin(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
     memmove((void *)(pa0 + (dstva - va0)), src, n);
+    uvmunpin();
 
     len -= n;
     src += n;
@@ -383,13 +492,14 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmpin(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
     memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    uvmunpin();
 
     len -= n;
     dst += n;
@@ -410,7 +520,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmpin(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -431,6 +541,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
       p++;
       dst++;
     }
+    uvmunpin();
 
     srcva = va0 + PGSIZE;
   }
@@ -18,12 +18,14 @@
 #define NINODES 200
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | inode blocks | inode bit map |
+//                                          free bit map | data blocks ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+int nimap = NINODES/(BSIZE*8) + 1;
+int nlog = LOGBLOCKS + 1;  // header and slots
+int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, inode bitmap, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
@@ -34,12 +36,15 @@ uint freeblock;
 
 
 void balloc(int);
+void imap(int);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void rootlink(struct dirent *de);
+void mkroot(uint rootino);
 
 // convert to intel byte order
 ushort
@@ -68,10 +73,9 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
+  uint rootino, inum;
   struct dirent de;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -91,7 +95,7 @@ main(int argc, char *argv[])
   }
 
   // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
+  nmeta = 2 + nlog + ninodeblocks + nimap + nbitmap;
   nblocks = FSSIZE - nmeta;
 
   sb.magic = FSMAGIC;
@@ -101,10 +105,11 @@ main(int argc, char *argv[])
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
-  sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.imapstart = xint(2+nlog+ninodeblocks);
+  sb.bmapstart = xint(2+nlog+ninodeblocks+nimap);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, inode bitmap blocks %u, bitmap blocks %u) blocks %d total %d\n",
+         nmeta, nlog, ninodeblocks, nimap, nbitmap, nblocks, FSSIZE);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
@@ -118,16 +123,6 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
-
   for(i = 2; i < argc; i++){
     // get rid of "user/"
     char *shortname;
@@ -155,7 +150,7 @@ main(int argc, char *argv[])
     bzero(&de, sizeof(de));
     de.inum = xshort(inum);
     strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    rootlink(&de);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -163,13 +158,9 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  mkroot(rootino);
 
+  imap(freeinode);
   balloc(freeblock);
 
   exit(0);
@@ -258,6 +249,23 @@ balloc(int used)
   wsect(sb.bmapstart, buf);
 }
 
+// Mark inodes 0 (never used) through used-1 allocated.
+void
+imap(int used)
+{
+  uchar buf[BSIZE];
+  int i;
+
+  printf("imap: first %d inodes have been allocated\n", used);
+  assert(used < BSIZE*8);
+  bzero(buf, BSIZE);
+  for(i = 0; i < used; i++){
+    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  }
+  printf("imap: write inode bitmap block at sector %d\n", sb.imapstart);
+  wsect(sb.imapstart, buf);
+}
+
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
 void
@@ -303,3 +311,73 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// The root directory is built as an indexed directory
+// (see kernel/fs.c) once all its names are known.
+#define DXFILL 48  // names per leaf, leaving room to grow
+
+struct dirent rootents[NINODES];
+int nrootents;
+
+void
+rootlink(struct dirent *de)
+{
+  assert(nrootents < NINODES);
+  rootents[nrootents++] = *de;
+}
+
+int
+hashcmp(const void *a, const void *b)
+{
+  uint x = dirhash(((struct dirent*)a)->name);
+  uint y = dirhash(((struct dirent*)b)->name);
+
+  return x < y ? -1 : x > y;
+}
+
+void
+mkroot(uint rootino)
+{
+  struct dirent root[DPB], leaf[DPB];
+  struct dxhead *h;
+  struct dxent *e;
+  int i, n, nleaf, start[DXROOTMAX+1];
+
+  // divide the names, in hash order, into leaves, never
+  // parting names with the same hash.
+  qsort(rootents, nrootents, sizeof(rootents[0]), hashcmp);
+  nleaf = 0;
+  for(i = 0; i < nrootents; ){
+    assert(nleaf < DXROOTMAX);
+    start[nleaf++] = i;
+    for(n = 0; i < nrootents && (n < DXFILL ||
+        dirhash(rootents[i].name) == dirhash(rootents[i-1].name)); n++)
+      i++;
+  }
+  if(nleaf == 0)
+    start[nleaf++] = 0;
+  start[nleaf] = nrootents;
+
+  bzero(root, sizeof(root));
+  root[0].inum = xshort(rootino);
+  strcpy(root[0].name, ".");
+  root[1].inum = xshort(rootino);
+  strcpy(root[1].name, "..");
+  h = (struct dxhead*)&root[2];
+  h->count = xshort(nleaf);
+  h->magic = xint(DXMAGIC);
+  h->depth = xint(0);
+  e = (struct dxent*)(h + 1);
+  for(i = 0; i < nleaf; i++){
+    e[i].block = xshort(1 + i);
+    e[i].hash = xint(i == 0 ? 0 : dirhash(rootents[start[i]].name));
+  }
+  iappend(rootino, root, sizeof(root));
+
+  for(i = 0; i < nleaf; i++){
+    bzero(leaf, sizeof(leaf));
+    assert(start[i+1] - start[i] <= DPB);
+    memmove(leaf, &rootents[start[i]], (start[i+1] - start[i]) * sizeof(leaf[0]));
+    iappend(rootino, leaf, sizeof(leaf));
+  }
+}
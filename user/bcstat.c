@@ -0,0 +1,44 @@
+// Print the buffer cache's size and counters, either since
+// boot or, given a command, for the time the command runs.
+//   bcstat [command [args...]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/bcachestat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct bcachestat st0, st1;
+  int pid;
+
+  memset(&st0, 0, sizeof(st0));
+  if(argc > 1){
+    bcachestat(&st0);
+    if((pid = fork()) < 0){
+      printf("bcstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv + 1);
+      printf("bcstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+  if(bcachestat(&st1) < 0){
+    printf("bcstat: bcachestat failed\n");
+    exit(1);
+  }
+
+  printf("buffers   %l of %l\n", st1.nbuf, st1.maxbuf);
+  printf("hits      %l\n", st1.hits - st0.hits);
+  printf("misses    %l\n", st1.misses - st0.misses);
+  if(st1.hits + st1.misses > st0.hits + st0.misses)
+    printf("hit rate  %l%%\n", (st1.hits - st0.hits) * 100 /
+           (st1.hits - st0.hits + st1.misses - st0.misses));
+  printf("evictions %l\n", st1.evictions - st0.evictions);
+  printf("shrinks   %l\n", st1.shrinks - st0.shrinks);
+  exit(0);
+}
@@ -1,13 +1,93 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/uring.h"
 #include "user/user.h"
 
+#define NBATCH 8
+#define SPLICECHUNK (64*1024)
+
 char buf[512];
+char bufs[NBATCH][512];
+struct uring ring;
+
+// Submit the queued requests and collect their results in
+// res, indexed by the data of each request.
+void
+submit(int *res)
+{
+  struct cqe c;
+
+  uring_enter(&ring);
+  while(uring_reap(&ring, &c))
+    res[c.data] = c.res;
+}
+
+// Copy a regular file NBATCH blocks at a time, with one
+// uring_enter() for the reads and one for the writes.
+void
+catfile(int fd)
+{
+  int i, n, res[NBATCH], len[NBATCH];
+
+  for(;;){
+    for(i = 0; i < NBATCH; i++){
+      uring_post(&ring, URING_READ, fd, bufs[i], sizeof(bufs[i]), i);
+      len[i] = -1;
+    }
+    submit(len);
+    n = 0;
+    for(i = 0; i < NBATCH && len[i] > 0; i++){
+      uring_post(&ring, URING_WRITE, 1, bufs[i], len[i], i);
+      n++;
+    }
+    submit(res);
+    for(i = 0; i < n; i++){
+      if(res[i] != len[i]){
+        fprintf(2, "cat: write error\n");
+        exit(1);
+      }
+    }
+    if(n < NBATCH){
+      if(len[n] < 0){
+        fprintf(2, "cat: read error\n");
+        exit(1);
+      }
+      return;
+    }
+  }
+}
+
+// Move a regular file to the standard output inside the
+// kernel. Returns 0, having moved nothing, if the standard
+// output is not a pipe or file.
+int
+catsplice(int fd)
+{
+  int n;
+
+  if((n = splice(fd, 1, SPLICECHUNK)) < 0)
+    return 0;
+  while(n > 0)
+    n = splice(fd, 1, SPLICECHUNK);
+  if(n < 0){
+    fprintf(2, "cat: write error\n");
+    exit(1);
+  }
+  return 1;
+}
 
 void
 cat(int fd)
 {
   int n;
+  struct stat st;
+
+  // reading ahead would stall a pipe or the console.
+  if(fstat(fd, &st) == 0 && st.type == T_FILE){
+    if(!catsplice(fd))
+      catfile(fd);
+    return;
+  }
 
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
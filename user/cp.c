@@ -0,0 +1,51 @@
+// Copy a file, moving the data inside the kernel with splice().
+//   cp src dst
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define SPLICECHUNK (64*1024)
+
+char buf[512];
+
+int
+main(int argc, char *argv[])
+{
+  int in, out, n;
+
+  if(argc != 3){
+    fprintf(2, "usage: cp src dst\n");
+    exit(1);
+  }
+  if((in = open(argv[1], O_RDONLY)) < 0){
+    fprintf(2, "cp: cannot open %s\n", argv[1]);
+    exit(1);
+  }
+  if((out = open(argv[2], O_CREATE | O_WRONLY | O_TRUNC)) < 0){
+    fprintf(2, "cp: cannot create %s\n", argv[2]);
+    exit(1);
+  }
+
+  // splice() fails before moving anything if either
+  // end is a device; copy those the old way.
+  if((n = splice(in, out, SPLICECHUNK)) >= 0){
+    while(n > 0)
+      n = splice(in, out, SPLICECHUNK);
+  } else {
+    while((n = read(in, buf, sizeof(buf))) > 0){
+      if(write(out, buf, n) != n){
+        n = -1;
+        break;
+      }
+    }
+  }
+  if(n < 0){
+    fprintf(2, "cp: error copying %s to %s\n", argv[1], argv[2]);
+    exit(1);
+  }
+  close(in);
+  close(out);
+  exit(0);
+}
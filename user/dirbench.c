@@ -0,0 +1,96 @@
+// Benchmark a large directory: create n links to one file
+// in a new directory, look each up, look up missing names,
+// then unlink them all. Prints operations per millisecond.
+//   dirbench [n]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+char path[] = "/dbench/e00000";
+#define NUM (sizeof(path) - 6)
+
+void
+setname(char c, int i)
+{
+  int j;
+
+  path[NUM-1] = c;
+  for(j = 4; j >= 0; j--){
+    path[NUM+j] = '0' + i % 10;
+    i /= 10;
+  }
+}
+
+void
+report(char *what, int n, uint64 t0)
+{
+  printf("%s\t%l\n", what, (uint64)n * 1000000 / (uptimens() - t0));
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct stat st;
+  int i, n, fd;
+  uint64 t0;
+
+  n = argc > 1 ? atoi(argv[1]) : 10000;
+  if(n > 99999)
+    n = 99999;
+
+  if(mkdir("/dbench") < 0 || (fd = open("/dbench/f", O_CREATE | O_WRONLY)) < 0){
+    printf("dirbench: cannot create /dbench/f\n");
+    exit(1);
+  }
+  close(fd);
+
+  printf("op\tops/ms\n");
+  t0 = uptimens();
+  for(i = 0; i < n; i++){
+    setname('e', i);
+    if(link("/dbench/f", path) < 0){
+      printf("dirbench: cannot link %s\n", path);
+      exit(1);
+    }
+  }
+  report("create", n, t0);
+
+  t0 = uptimens();
+  for(i = 0; i < n; i++){
+    setname('e', i);
+    if(stat(path, &st) < 0){
+      printf("dirbench: cannot find %s\n", path);
+      exit(1);
+    }
+  }
+  report("lookup", n, t0);
+
+  t0 = uptimens();
+  for(i = 0; i < n; i++){
+    setname('m', i);
+    if(stat(path, &st) >= 0){
+      printf("dirbench: found %s\n", path);
+      exit(1);
+    }
+  }
+  report("missing", n, t0);
+
+  t0 = uptimens();
+  for(i = 0; i < n; i++){
+    setname('e', i);
+    if(unlink(path) < 0){
+      printf("dirbench: cannot unlink %s\n", path);
+      exit(1);
+    }
+  }
+  report("unlink", n, t0);
+
+  unlink("/dbench/f");
+  if(unlink("/dbench") < 0){
+    printf("dirbench: /dbench not empty\n");
+    exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,121 @@
+// Benchmark the futex-based mutex and condition variable:
+// uncontended lock/unlock cost, handoff latency between two
+// threads, and throughput with several threads contending.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NUNCONTENDED 100000
+#define NHANDOFF     1000
+#define NCONTEND     4
+#define NINCR        20000
+
+struct mutex m;
+struct cond cv;
+volatile int turn;
+volatile int counter;
+
+void
+uncontended(void)
+{
+  uint64 t0, t1;
+  int i;
+
+  t0 = uptimens();
+  for(i = 0; i < NUNCONTENDED; i++){
+    mutex_lock(&m);
+    mutex_unlock(&m);
+  }
+  t1 = uptimens();
+  printf("uncontended lock+unlock: %l ns\n", (t1 - t0) / NUNCONTENDED);
+}
+
+// wait for our turn, then hand it to the other thread.
+void
+pingpong(int me)
+{
+  int i;
+
+  for(i = 0; i < NHANDOFF; i++){
+    mutex_lock(&m);
+    while(turn != me)
+      cond_wait(&cv, &m);
+    turn = !me;
+    cond_signal(&cv);
+    mutex_unlock(&m);
+  }
+}
+
+void
+pong(void *arg)
+{
+  pingpong(1);
+}
+
+void
+handoff(void)
+{
+  uint64 t0, t1;
+  int tid;
+
+  turn = 0;
+  t0 = uptimens();
+  if((tid = thread_create(pong, 0)) < 0){
+    printf("lockbench: thread_create failed\n");
+    exit(1);
+  }
+  pingpong(0);
+  thread_join(tid);
+  t1 = uptimens();
+  printf("condvar handoff: %l ns\n", (t1 - t0) / (2 * NHANDOFF));
+}
+
+void
+incr(void *arg)
+{
+  int i;
+
+  for(i = 0; i < NINCR; i++){
+    mutex_lock(&m);
+    counter++;
+    mutex_unlock(&m);
+  }
+}
+
+void
+contended(void)
+{
+  int tids[NCONTEND];
+  uint64 t0, t1;
+  int i;
+
+  counter = 0;
+  t0 = uptimens();
+  for(i = 0; i < NCONTEND; i++){
+    if((tids[i] = thread_create(incr, 0)) < 0){
+      printf("lockbench: thread_create failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < NCONTEND; i++)
+    thread_join(tids[i]);
+  t1 = uptimens();
+  if(counter != NCONTEND * NINCR){
+    printf("lockbench: counter %d, expected %d\n", counter, NCONTEND * NINCR);
+    exit(1);
+  }
+  printf("%d threads contending: %l ns per lock+unlock\n", NCONTEND,
+         (t1 - t0) / (NCONTEND * NINCR));
+}
+
+int
+main(int argc, char *argv[])
+{
+  mutex_init(&m);
+  cond_init(&cv);
+  uncontended();
+  handoff();
+  contended();
+  exit(0);
+}
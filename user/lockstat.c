@@ -0,0 +1,92 @@
+// Print the most contended lock classes, either since boot
+// or over a run of the given command. max-hold is
+// always the longest hold since boot.
+//   lockstat [-n count] [command args...]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+#define NSTAT 64
+
+struct lockstat st0[NSTAT], st1[NSTAT];
+
+// Read all records into st; returns how many.
+int
+snapshot(struct lockstat *st)
+{
+  int fd, n;
+
+  if((fd = open("lockstat", O_RDONLY)) < 0){
+    fprintf(2, "lockstat: cannot open lockstat\n");
+    exit(1);
+  }
+  n = read(fd, st, NSTAT * sizeof(*st));
+  close(fd);
+  if(n < 0){
+    fprintf(2, "lockstat: read failed\n");
+    exit(1);
+  }
+  return n / sizeof(*st);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, k, n, pid, top;
+  int order[NSTAT];
+  struct lockstat *s;
+
+  top = 10;
+  if(argc > 2 && strcmp(argv[1], "-n") == 0){
+    top = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+
+  memset(st0, 0, sizeof(st0));
+  if(argc > 1){
+    snapshot(st0);
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv + 1);
+      fprintf(2, "lockstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+  n = snapshot(st1);
+
+  // records never move, so a record's index is the same in both
+  // snapshots, and one added since st0 was taken is all zeros there.
+  for(i = 0; i < n; i++){
+    s = &st1[i];
+    s->nacquire -= st0[i].nacquire;
+    s->ncontend -= st0[i].ncontend;
+    s->waitcycles -= st0[i].waitcycles;
+    s->nspin -= st0[i].nspin;
+    s->nsleep -= st0[i].nsleep;
+    // insertion sort by contended acquisitions.
+    for(j = i; j > 0 && st1[order[j-1]].ncontend < s->ncontend; j--)
+      order[j] = order[j-1];
+    order[j] = i;
+  }
+
+  printf("name            type   acquires  contended  wait-cycles  max-hold  spun  slept\n");
+  for(k = 0; k < n && k < top; k++){
+    s = &st1[order[k]];
+    printf("%s", s->name);
+    for(j = strlen(s->name); j < 16; j++)
+      printf(" ");
+    printf("%s  %l  %l  %l  %l  %l  %l\n", s->type == LS_SLEEP ? "sleep" : "spin ",
+           s->nacquire, s->ncontend, s->waitcycles, s->maxhold,
+           s->nspin, s->nsleep);
+  }
+  exit(0);
+}
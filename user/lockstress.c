@@ -0,0 +1,180 @@
+// Stress the kernel's global locks from several harts at once,
+// to compare the spinlock implementations (make LOCK=...).
+//   lockstress [maxharts [ops]]
+// For n = 2 up to maxharts (at most the online harts), runs n
+// processes, each pinned to its own hart, through each workload:
+//   kalloc: grow by a page with sbrk() and shrink again (kmem.lock)
+//   bread:  read a private file whose blocks are cached (bcache.lock)
+// and prints the total throughput and the slowest single operation.
+// Run it under lockstat to see where the waiting happened.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/cpustat.h"
+#include "user/user.h"
+
+#define FILEBLOCKS 64  // BSIZE blocks in each file
+
+char buf[BSIZE];
+
+void
+kallocop(int fd)
+{
+  char *p;
+
+  if((p = sbrk(4096)) == (char*)-1){
+    printf("lockstress: sbrk failed\n");
+    exit(1);
+  }
+  p[0] = 1;
+  sbrk(-4096);
+}
+
+// read the next block.
+void
+breadop(int fd)
+{
+  if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("lockstress: read failed\n");
+    exit(1);
+  }
+}
+
+struct workload {
+  char *name;
+  void (*op)(int);
+} workloads[] = {
+  { "kalloc", kallocop },
+  { "bread", breadop },
+};
+
+char*
+fname(int i)
+{
+  static char name[] = "lstress0";
+
+  name[7] = '0' + i;
+  return name;
+}
+
+// Run ops operations on hart cpu once go is readable,
+// then write the worst latency to out.
+void
+worker(struct workload *w, int cpu, int ops, int go, int out)
+{
+  uint64 t0, t, max;
+  int i, fd;
+  char c;
+
+  if(setaffinity(0, 1UL << cpu) < 0){
+    printf("lockstress: cannot run on hart %d\n", cpu);
+    exit(1);
+  }
+  fd = open(fname(cpu), O_RDONLY);
+  read(go, &c, 1);
+  max = 0;
+  for(i = 0; i < ops; i++){
+    // start over at the end of the file.
+    if(w->op == breadop && i > 0 && i % FILEBLOCKS == 0){
+      close(fd);
+      fd = open(fname(cpu), O_RDONLY);
+    }
+    t0 = uptimens();
+    w->op(fd);
+    t = uptimens() - t0;
+    if(t > max)
+      max = t;
+  }
+  write(out, &max, sizeof(max));
+  exit(0);
+}
+
+void
+run(struct workload *w, int n, int ops)
+{
+  int go[2], out[2], i;
+  uint64 t0, t1, max, m;
+
+  if(pipe(go) < 0 || pipe(out) < 0){
+    printf("lockstress: pipe failed\n");
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("lockstress: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(go[1]);
+      close(out[0]);
+      worker(w, i, ops, go[0], out[1]);
+    }
+  }
+  close(go[0]);
+  close(out[1]);
+
+  // let them all go at once.
+  t0 = uptimens();
+  for(i = 0; i < n; i++)
+    write(go[1], "x", 1);
+  max = 0;
+  for(i = 0; i < n; i++){
+    if(read(out[0], &m, sizeof(m)) != sizeof(m)){
+      printf("lockstress: worker failed\n");
+      exit(1);
+    }
+    if(m > max)
+      max = m;
+  }
+  t1 = uptimens();
+  for(i = 0; i < n; i++)
+    wait(0);
+  close(go[1]);
+  close(out[0]);
+
+  printf("%s\t%d\t%l\t%l\n", w->name, n,
+         (uint64)n * ops * 1000000 / (t1 - t0), max / 1000);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct cpustat st;
+  int i, j, fd, ncpu, maxn, ops;
+
+  ncpu = 0;
+  while(ncpu < NCPU && cpustat(ncpu, &st) == 0)
+    ncpu++;
+  maxn = argc > 1 ? atoi(argv[1]) : NCPU;
+  if(maxn > ncpu)
+    maxn = ncpu;
+  ops = argc > 2 ? atoi(argv[2]) : 2000;
+  if(maxn < 2){
+    printf("lockstress: need at least 2 harts\n");
+    exit(1);
+  }
+
+  memset(buf, 'x', sizeof(buf));
+  for(i = 0; i < maxn; i++){
+    if((fd = open(fname(i), O_CREATE | O_TRUNC | O_WRONLY)) < 0){
+      printf("lockstress: cannot create %s\n", fname(i));
+      exit(1);
+    }
+    for(j = 0; j < FILEBLOCKS; j++)
+      write(fd, buf, sizeof(buf));
+    close(fd);
+  }
+
+  printf("workload\tharts\tops/ms\tmax-us\n");
+  for(j = 0; j < sizeof(workloads)/sizeof(workloads[0]); j++)
+    for(i = 2; i <= maxn; i++)
+      run(&workloads[j], i, ops);
+
+  for(i = 0; i < maxn; i++)
+    unlink(fname(i));
+  exit(0);
+}
@@ -0,0 +1,84 @@
+// Benchmark path lookup in a directory of 1000 entries,
+// all links to one file: open names near the end of the
+// directory, which a scan reaches last, and names that are
+// not there. Prints opens per millisecond.
+//   lookupbench [rounds]
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NENTRY 1000
+#define NHOT   100    // names opened repeatedly
+
+char path[] = "/lbench/n000";
+#define NUM (sizeof(path) - 4)
+
+void
+setname(char c, int i)
+{
+  path[NUM-1] = c;
+  path[NUM] = '0' + i / 100;
+  path[NUM+1] = '0' + i / 10 % 10;
+  path[NUM+2] = '0' + i % 10;
+}
+
+// Open names first..first+n-1 rounds times, expecting
+// them to exist or not. Returns opens per millisecond.
+uint64
+run(char c, int first, int n, int rounds, int exist)
+{
+  int i, r, fd;
+  uint64 t0, t1;
+
+  t0 = uptimens();
+  for(r = 0; r < rounds; r++){
+    for(i = first; i < first + n; i++){
+      setname(c, i);
+      fd = open(path, O_RDONLY);
+      if((fd >= 0) != exist){
+        printf("lookupbench: open %s returned %d\n", path, fd);
+        exit(1);
+      }
+      if(fd >= 0)
+        close(fd);
+    }
+  }
+  t1 = uptimens();
+  return (uint64)n * rounds * 1000000 / (t1 - t0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, fd, rounds;
+
+  rounds = argc > 1 ? atoi(argv[1]) : 20;
+
+  mkdir("/lbench");
+  if((fd = open("/lbench/f", O_CREATE | O_WRONLY)) < 0){
+    printf("lookupbench: cannot create /lbench/f\n");
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < NENTRY; i++){
+    setname('n', i);
+    if(link("/lbench/f", path) < 0){
+      printf("lookupbench: cannot link %s\n", path);
+      exit(1);
+    }
+  }
+
+  printf("names\topens/ms\n");
+  printf("last %d\t%l\n", NHOT, run('n', NENTRY - NHOT, NHOT, rounds, 1));
+  printf("missing\t%l\n", run('m', 0, NHOT, rounds, 0));
+  printf("all\t%l\n", run('n', 0, NENTRY, 1, 1));
+
+  for(i = 0; i < NENTRY; i++){
+    setname('n', i);
+    unlink(path);
+  }
+  unlink("/lbench/f");
+  unlink("/lbench");
+  exit(0);
+}
@@ -0,0 +1,44 @@
+// Print per-CPU scheduling statistics, either since boot
+// or, given a number of ticks, over that interval.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/cpustat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct cpustat st0[NCPU], st1[NCPU];
+  int online[NCPU];
+  uint64 t0, t1;
+  int i;
+
+  for(i = 0; i < NCPU; i++){
+    memset(&st0[i], 0, sizeof(st0[i]));
+    online[i] = 0;
+  }
+  t0 = 0;
+  if(argc > 1){
+    for(i = 0; i < NCPU; i++)
+      cpustat(i, &st0[i]);
+    t0 = uptimens();
+    sleep(atoi(argv[1]));
+  }
+  t1 = uptimens();
+  for(i = 0; i < NCPU; i++)
+    online[i] = cpustat(i, &st1[i]) == 0;
+
+  printf("cpu   switches  migrations  idle%%  timer-intrs\n");
+  for(i = 0; i < NCPU; i++){
+    if(!online[i])
+      continue;
+    printf("%d     %l       %l        %l     %l\n", i,
+           st1[i].nswtch - st0[i].nswtch,
+           st1[i].nmigrate - st0[i].nmigrate,
+           (st1[i].idle - st0[i].idle) * 100 / (t1 - t0),
+           st1[i].timerintr - st0[i].timerintr);
+  }
+  exit(0);
+}
@@ -0,0 +1,122 @@
+// Benchmark parallel path lookup: n processes, each pinned
+// to its own hart, repeatedly open, fstat and close a file
+// three directories deep, either each its own file or all
+// the same one. Prints total operations per millisecond.
+//   openbench [ops]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "kernel/cpustat.h"
+#include "user/user.h"
+
+char path[] = "/obench/a/b/c/f0";
+#define FILECHAR (sizeof(path) - 2)
+
+void
+worker(int cpu, int same, int ops, int go)
+{
+  struct stat st;
+  int i, fd;
+  char c;
+
+  if(setaffinity(0, 1UL << cpu) < 0){
+    printf("openbench: cannot run on hart %d\n", cpu);
+    exit(1);
+  }
+  path[FILECHAR] = same ? '0' : '0' + cpu;
+  read(go, &c, 1);
+  for(i = 0; i < ops; i++){
+    if((fd = open(path, O_RDONLY)) < 0){
+      printf("openbench: cannot open %s\n", path);
+      exit(1);
+    }
+    if(fstat(fd, &st) < 0 || st.type != T_FILE){
+      printf("openbench: fstat failed\n");
+      exit(1);
+    }
+    close(fd);
+  }
+  exit(0);
+}
+
+void
+run(int n, int same, int ops)
+{
+  int go[2], i, xstatus;
+  uint64 t0, t1;
+
+  if(pipe(go) < 0){
+    printf("openbench: pipe failed\n");
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("openbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(go[1]);
+      worker(i, same, ops, go[0]);
+    }
+  }
+  close(go[0]);
+
+  // let them all go at once.
+  t0 = uptimens();
+  for(i = 0; i < n; i++)
+    write(go[1], "x", 1);
+  for(i = 0; i < n; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  t1 = uptimens();
+  close(go[1]);
+
+  printf("%s\t%d\t%l\n", same ? "same" : "own", n,
+         (uint64)n * ops * 1000000 / (t1 - t0));
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct cpustat st;
+  int i, fd, ncpu, ops;
+
+  ncpu = 0;
+  while(ncpu < NCPU && cpustat(ncpu, &st) == 0)
+    ncpu++;
+  ops = argc > 1 ? atoi(argv[1]) : 1000;
+
+  mkdir("/obench");
+  mkdir("/obench/a");
+  mkdir("/obench/a/b");
+  mkdir("/obench/a/b/c");
+  for(i = 0; i < ncpu; i++){
+    path[FILECHAR] = '0' + i;
+    if((fd = open(path, O_CREATE | O_WRONLY)) < 0){
+      printf("openbench: cannot create %s\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  printf("files\tharts\tops/ms\n");
+  for(i = 1; i <= ncpu; i++)
+    run(i, 0, ops);
+  for(i = 2; i <= ncpu; i++)
+    run(i, 1, ops);
+
+  for(i = 0; i < ncpu; i++){
+    path[FILECHAR] = '0' + i;
+    unlink(path);
+  }
+  unlink("/obench/a/b/c");
+  unlink("/obench/a/b");
+  unlink("/obench/a");
+  unlink("/obench");
+  exit(0);
+}
@@ -0,0 +1,112 @@
+// Parallel find: each directory is searched by its own
+// task, so subdirectories are searched in parallel by
+// the task library's workers.
+//
+// A task runs start to finish on one worker without
+// yielding, so the file descriptors it opens stay in
+// the one kernel thread's table.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+
+char *target;
+int verbose;
+volatile uint nfound;
+struct mutex mu;  // for malloc() and printing
+
+char*
+pathdup(char *s)
+{
+  char *p;
+
+  mutex_lock(&mu);
+  p = malloc(strlen(s) + 1);
+  mutex_unlock(&mu);
+  if(p == 0){
+    printf("pfind: out of memory\n");
+    exit(1);
+  }
+  strcpy(p, s);
+  return p;
+}
+
+void
+search(void *arg)
+{
+  char *path = arg;
+  char buf[512], *p;
+  struct dirent de;
+  struct stat st;
+  int fd;
+
+  if((fd = open(path, 0)) < 0){
+    fprintf(2, "pfind: cannot open %s\n", path);
+    goto out;
+  }
+  if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
+    fprintf(2, "pfind: path too long\n");
+    goto out;
+  }
+  strcpy(buf, path);
+  p = buf + strlen(buf);
+  *p++ = '/';
+  while(read(fd, &de, sizeof(de)) == sizeof(de)){
+    if(de.inum == 0 || strcmp(de.name, ".") == 0 || strcmp(de.name, "..") == 0)
+      continue;
+    memmove(p, de.name, DIRSIZ);
+    p[DIRSIZ] = 0;
+    if(stat(buf, &st) < 0){
+      fprintf(2, "pfind: cannot stat %s\n", buf);
+      continue;
+    }
+    if(st.type == T_DIR)
+      task_spawn(search, pathdup(buf));
+    if(strcmp(p, target) == 0){
+      __sync_fetch_and_add(&nfound, 1);
+      if(verbose){
+        mutex_lock(&mu);
+        printf("%s\n", buf);
+        mutex_unlock(&mu);
+      }
+    }
+  }
+
+ out:
+  if(fd >= 0)
+    close(fd);
+  mutex_lock(&mu);
+  free(path);
+  mutex_unlock(&mu);
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 t0, t1, ntask, nsteal;
+  int nw;
+
+  if(argc != 3){
+    fprintf(2, "usage: pfind dir name\n");
+    exit(1);
+  }
+  target = argv[2];
+  mutex_init(&mu);
+
+  // print the matches once, then time more workers.
+  for(nw = 1; nw <= 4; nw *= 2){
+    verbose = nw == 1;
+    nfound = 0;
+    t0 = uptimens();
+    if(task_run(nw, search, pathdup(argv[1])) < 0){
+      printf("pfind: task_run failed\n");
+      exit(1);
+    }
+    t1 = uptimens();
+    task_stats(&ntask, &nsteal);
+    printf("%d workers: %d found in %l ms (%l tasks, %l stolen)\n",
+           nw, nfound, (t1 - t0) / 1000000, ntask, nsteal);
+  }
+  exit(0);
+}
@@ -0,0 +1,76 @@
+// Benchmark pipe throughput: a child writes bytes through a
+// pipe in writes of several sizes, and the parent reads them.
+// Prints MB/s for each write size.
+//   pipebench [kbytes [pipe-bytes]]
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+int sizes[] = { 1, 64, 512, 4096, 16384 };
+char buf[16384];
+
+void
+run(int wsize, int total, int psize)
+{
+  int p[2], n, got, xstatus;
+  uint64 t0, t1;
+
+  if(pipe(p) < 0){
+    printf("pipebench: pipe failed\n");
+    exit(1);
+  }
+  if(psize && fcntl(p[1], F_SETPIPESZ, psize) < 0){
+    printf("pipebench: cannot resize pipe to %d\n", psize);
+    exit(1);
+  }
+  psize = fcntl(p[1], F_GETPIPESZ, 0);
+
+  t0 = uptimens();
+  int pid = fork();
+  if(pid < 0){
+    printf("pipebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[0]);
+    for(n = 0; n < total; n += wsize){
+      if(write(p[1], buf, wsize) != wsize){
+        printf("pipebench: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(p[1]);
+  got = 0;
+  while((n = read(p[0], buf, sizeof(buf))) > 0)
+    got += n;
+  close(p[0]);
+  wait(&xstatus);
+  t1 = uptimens();
+  if(xstatus != 0 || got != total){
+    printf("pipebench: read %d of %d bytes\n", got, total);
+    exit(1);
+  }
+
+  // bytes per microsecond is MB/s.
+  printf("%d\t%d\t%l\n", psize, wsize,
+         (uint64)total * 1000 / (t1 - t0));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, total, psize;
+
+  total = (argc > 1 ? atoi(argv[1]) : 1024) * 1024;
+  psize = argc > 2 ? atoi(argv[2]) : 0;
+
+  printf("pipe\twrite\tMB/s\n");
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    // single-byte writes are slow; don't wait all day.
+    run(sizes[i], sizes[i] == 1 ? total / 64 : total, psize);
+  }
+  exit(0);
+}
@@ -0,0 +1,68 @@
+// Count primes in parallel with the task library,
+// splitting the range in halves down to GRAIN numbers
+// so that idle workers have something to steal.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define N     200000
+#define GRAIN 1000
+
+volatile uint nprimes;
+
+// a task's range of numbers, packed into its argument.
+#define RANGE(lo, hi) ((void*)(((uint64)(lo) << 32) | (hi)))
+#define LO(a) ((uint64)(a) >> 32)
+#define HI(a) ((uint64)(a) & 0xffffffff)
+
+int
+isprime(uint n)
+{
+  uint d;
+
+  if(n < 2)
+    return 0;
+  for(d = 2; d * d <= n; d++)
+    if(n % d == 0)
+      return 0;
+  return 1;
+}
+
+void
+count(void *arg)
+{
+  uint lo = LO(arg), hi = HI(arg), mid, i, n;
+
+  if(hi - lo > GRAIN){
+    mid = lo + (hi - lo) / 2;
+    task_spawn(count, RANGE(lo, mid));
+    task_spawn(count, RANGE(mid, hi));
+    return;
+  }
+  n = 0;
+  for(i = lo; i < hi; i++)
+    n += isprime(i);
+  __sync_fetch_and_add(&nprimes, n);
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 t0, t1, ntask, nsteal;
+  int nw;
+
+  for(nw = 1; nw <= 4; nw *= 2){
+    nprimes = 0;
+    t0 = uptimens();
+    if(task_run(nw, count, RANGE(0, N)) < 0){
+      printf("pprimes: task_run failed\n");
+      exit(1);
+    }
+    t1 = uptimens();
+    task_stats(&ntask, &nsteal);
+    printf("%d workers: %d primes below %d in %l ms (%l tasks, %l stolen)\n",
+           nw, nprimes, N, (t1 - t0) / 1000000, ntask, nsteal);
+  }
+  exit(0);
+}
@@ -0,0 +1,69 @@
+// Measure nsleep() accuracy and how often idle CPUs
+// take timer interrupts.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/cpustat.h"
+#include "user/user.h"
+
+#define NROUND 20
+
+void
+accuracy(uint64 ns)
+{
+  uint64 t0, late, sum, max;
+  int i;
+
+  sum = max = 0;
+  for(i = 0; i < NROUND; i++){
+    t0 = uptimens();
+    if(nsleep(ns) < 0){
+      printf("sleepbench: nsleep failed\n");
+      exit(1);
+    }
+    late = uptimens() - t0;
+    if(late < ns){
+      printf("sleepbench: woke %l ns early\n", ns - late);
+      exit(1);
+    }
+    late -= ns;
+    sum += late;
+    if(late > max)
+      max = late;
+  }
+  printf("nsleep %l us: overshoot avg %l us max %l us\n",
+         ns / 1000, sum / NROUND / 1000, max / 1000);
+}
+
+void
+idlerate(void)
+{
+  struct cpustat st0[NCPU], st1[NCPU];
+  int online[NCPU];
+  uint64 t0, t1;
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    online[i] = cpustat(i, &st0[i]) == 0;
+  t0 = uptimens();
+  sleep(10);
+  t1 = uptimens();
+  for(i = 0; i < NCPU; i++){
+    if(!online[i] || cpustat(i, &st1[i]) < 0)
+      continue;
+    printf("cpu %d: %l timer interrupts/s while idle\n", i,
+           (st1[i].timerintr - st0[i].timerintr) * 1000000000 / (t1 - t0));
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  accuracy(100000);
+  accuracy(1000000);
+  accuracy(10000000);
+  accuracy(50000000);
+  idlerate();
+  exit(0);
+}
@@ -0,0 +1,69 @@
+// Stress the sleep timer wheel: many processes sleeping
+// for different numbers of ticks at once. Reports context
+// switches per second, which should track the number of
+// sleeps that expire rather than the number of sleepers.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/cpustat.h"
+#include "user/user.h"
+
+#define NSLEEPER 60
+#define DURATION 50   // ticks
+
+uint64
+nswtch(void)
+{
+  struct cpustat st;
+  uint64 n = 0;
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    if(cpustat(i, &st) == 0)
+      n += st.nswtch;
+  return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, pid, n, status, start, wakeups;
+  uint64 sw0, sw1, t0, t1;
+
+  start = uptime();
+  sw0 = nswtch();
+  t0 = uptimens();
+  for(i = 0; i < NSLEEPER; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("sleepstress: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      // sleep 1..8 ticks at a time until DURATION is up.
+      n = 0;
+      while(uptime() - start < DURATION){
+        sleep(1 + i % 8);
+        n++;
+      }
+      exit(n);
+    }
+  }
+
+  wakeups = 0;
+  for(i = 0; i < NSLEEPER; i++){
+    if(wait(&status) < 0){
+      printf("sleepstress: wait failed\n");
+      exit(1);
+    }
+    wakeups += status;
+  }
+  t1 = uptimens();
+  sw1 = nswtch();
+
+  printf("%d sleepers, %d wakeups: %l context switches/s, %l wakeups/s\n",
+         NSLEEPER, wakeups, (sw1 - sw0) * 1000000000 / (t1 - t0),
+         (uint64)wakeups * 1000000000 / (t1 - t0));
+  exit(0);
+}
@@ -0,0 +1,131 @@
+// Benchmark splice() against the read/write loop cat uses:
+// copy a file into a pipe drained by a child, and copy a file
+// to another file, each several times. Prints MB/s.
+//   splicebench [kbytes [rounds]]
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define SPLICECHUNK (64*1024)
+
+char buf[512];
+char big[4096];
+
+// Copy fd to out with 512-byte reads and writes, as cat does,
+// or with splice().
+void
+copy(int fd, int out, int spliced)
+{
+  int n;
+
+  if(spliced){
+    while((n = splice(fd, out, SPLICECHUNK)) > 0)
+      ;
+  } else {
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      if(write(out, buf, n) != n)
+        n = -1;
+  }
+  if(n < 0){
+    printf("splicebench: copy failed\n");
+    exit(1);
+  }
+}
+
+// Copy the file rounds times into a pipe.
+uint64
+topipe(int size, int rounds, int spliced)
+{
+  int p[2], i, fd, n, got, xstatus;
+  uint64 t0, t1;
+
+  if(pipe(p) < 0){
+    printf("splicebench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptimens();
+  int pid = fork();
+  if(pid < 0){
+    printf("splicebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[0]);
+    for(i = 0; i < rounds; i++){
+      if((fd = open("sbench.in", O_RDONLY)) < 0)
+        exit(1);
+      copy(fd, p[1], spliced);
+      close(fd);
+    }
+    exit(0);
+  }
+  close(p[1]);
+  got = 0;
+  while((n = read(p[0], big, sizeof(big))) > 0)
+    got += n;
+  close(p[0]);
+  wait(&xstatus);
+  t1 = uptimens();
+  if(xstatus != 0 || got != size * rounds){
+    printf("splicebench: pipe got %d of %d bytes\n", got, size * rounds);
+    exit(1);
+  }
+  return (uint64)size * rounds * 1000 / (t1 - t0);
+}
+
+// Copy the file rounds times to another file.
+uint64
+tofile(int size, int rounds, int spliced)
+{
+  int i, fd, out;
+  uint64 t0, t1;
+
+  t0 = uptimens();
+  for(i = 0; i < rounds; i++){
+    fd = open("sbench.in", O_RDONLY);
+    out = open("sbench.out", O_CREATE | O_WRONLY | O_TRUNC);
+    if(fd < 0 || out < 0){
+      printf("splicebench: open failed\n");
+      exit(1);
+    }
+    copy(fd, out, spliced);
+    close(fd);
+    close(out);
+  }
+  t1 = uptimens();
+  return (uint64)size * rounds * 1000 / (t1 - t0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, fd, size, rounds;
+
+  size = (argc > 1 ? atoi(argv[1]) : 64) * 1024;
+  rounds = argc > 2 ? atoi(argv[2]) : 8;
+
+  if((fd = open("sbench.in", O_CREATE | O_WRONLY | O_TRUNC)) < 0){
+    printf("splicebench: cannot create sbench.in\n");
+    exit(1);
+  }
+  for(i = 0; i < sizeof(big); i++)
+    big[i] = 'a' + i % 26;
+  for(i = 0; i < size; i += sizeof(big)){
+    if(write(fd, big, sizeof(big)) != sizeof(big)){
+      printf("splicebench: cannot write sbench.in\n");
+      exit(1);
+    }
+  }
+  close(fd);
+  size = i;
+
+  // bytes per microsecond is MB/s.
+  printf("copy\tread/write\tsplice\n");
+  printf("pipe\t%l\t\t%l\n", topipe(size, rounds, 0), topipe(size, rounds, 1));
+  printf("file\t%l\t\t%l\n", tofile(size, rounds, 0), tofile(size, rounds, 1));
+
+  unlink("sbench.in");
+  unlink("sbench.out");
+  exit(0);
+}
@@ -0,0 +1,343 @@
+// Green threads ("tasks") multiplexed M:N onto kernel threads.
+//
+// task_run() starts nworkers workers: the calling thread and
+// nworkers-1 threads made with thread_create(). Each worker
+// keeps a deque of runnable tasks. A worker pushes and pops the
+// tasks it spawns at the bottom of its own deque, and when that
+// is empty steals from the top of another worker's, so large
+// chunks of work move between workers and small ones stay put.
+// Tasks get a stack when they first run, and switch to and from
+// their worker's scheduler loop with uswtch(). Idle workers
+// sleep on a futex until there is more work.
+//
+// A worker finds its own state through the tp register,
+// which nothing else in user space uses.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NWORKER   8
+#define TASKSTACK 8192
+
+// callee-saved registers, as saved by uswtch.S.
+struct ucontext {
+  uint64 ra;
+  uint64 sp;
+  uint64 s[12];
+};
+
+struct task {
+  struct ucontext ctx;
+  void (*fn)(void*);
+  void *arg;
+  char *stack;            // allocated when the task first runs
+  int done;
+  struct task *next;      // deque links
+  struct task *prev;
+};
+
+struct worker {
+  volatile uint lock;     // protects top and bottom
+  struct task *top;       // thieves take from here
+  struct task *bottom;    // the owner pushes and pops here
+  struct ucontext sched;  // scheduler loop, in schedule()
+  struct task *cur;       // task running on this worker
+  char *stacks;           // free stacks; first word links them
+  uint64 nrun;            // tasks run to completion
+  uint64 nsteal;          // tasks stolen from other workers
+};
+
+void uswtch(struct ucontext*, struct ucontext*);
+
+static struct worker workers[NWORKER];
+static int nworker;
+static volatile uint ntask;    // spawned tasks not yet done
+static volatile uint workseq;  // bumped when work appears or all is done
+static volatile uint nidle;    // workers asleep on workseq
+static struct mutex allocmu;   // malloc() is not thread-safe
+
+static struct worker*
+me(void)
+{
+  struct worker *w;
+
+  asm volatile("mv %0, tp" : "=r" (w));
+  return w;
+}
+
+static void
+spinlock(volatile uint *l)
+{
+  while(__sync_lock_test_and_set(l, 1) != 0)
+    ;
+}
+
+static void
+spinunlock(volatile uint *l)
+{
+  __sync_lock_release(l);
+}
+
+static void
+pushbottom(struct worker *w, struct task *t)
+{
+  spinlock(&w->lock);
+  t->next = 0;
+  t->prev = w->bottom;
+  if(w->bottom)
+    w->bottom->next = t;
+  else
+    w->top = t;
+  w->bottom = t;
+  spinunlock(&w->lock);
+}
+
+static void
+pushtop(struct worker *w, struct task *t)
+{
+  spinlock(&w->lock);
+  t->prev = 0;
+  t->next = w->top;
+  if(w->top)
+    w->top->prev = t;
+  else
+    w->bottom = t;
+  w->top = t;
+  spinunlock(&w->lock);
+}
+
+static struct task*
+popbottom(struct worker *w)
+{
+  struct task *t;
+
+  spinlock(&w->lock);
+  if((t = w->bottom) != 0){
+    w->bottom = t->prev;
+    if(w->bottom)
+      w->bottom->next = 0;
+    else
+      w->top = 0;
+  }
+  spinunlock(&w->lock);
+  return t;
+}
+
+static struct task*
+poptop(struct worker *w)
+{
+  struct task *t;
+
+  // don't bother taking the lock of an empty deque.
+  if(w->top == 0)
+    return 0;
+  spinlock(&w->lock);
+  if((t = w->top) != 0){
+    w->top = t->next;
+    if(w->top)
+      w->top->prev = 0;
+    else
+      w->bottom = 0;
+  }
+  spinunlock(&w->lock);
+  return t;
+}
+
+// Take a task from some other worker, starting with
+// the one after w so that thieves spread out.
+static struct task*
+steal(struct worker *w)
+{
+  struct task *t;
+  int i, self;
+
+  self = w - workers;
+  for(i = 1; i < nworker; i++){
+    if((t = poptop(&workers[(self + i) % nworker])) != 0){
+      w->nsteal++;
+      return t;
+    }
+  }
+  return 0;
+}
+
+static void*
+lockedmalloc(uint n)
+{
+  void *p;
+
+  mutex_lock(&allocmu);
+  p = malloc(n);
+  mutex_unlock(&allocmu);
+  return p;
+}
+
+static void
+lockedfree(void *p)
+{
+  mutex_lock(&allocmu);
+  free(p);
+  mutex_unlock(&allocmu);
+}
+
+// First code run by a new task, on its own stack.
+static void
+taskstart(void)
+{
+  struct task *t = me()->cur;
+
+  t->fn(t->arg);
+  t->done = 1;
+  uswtch(&t->ctx, &me()->sched);
+}
+
+// Run t until it yields or finishes.
+static void
+run(struct worker *w, struct task *t)
+{
+  if(t->stack == 0){
+    if((t->stack = w->stacks) != 0)
+      w->stacks = *(char**)t->stack;
+    else if((t->stack = lockedmalloc(TASKSTACK)) == 0){
+      printf("task: out of memory\n");
+      exit(1);
+    }
+    t->ctx.ra = (uint64)taskstart;
+    t->ctx.sp = (uint64)(t->stack + TASKSTACK);
+  }
+
+  w->cur = t;
+  uswtch(&w->sched, &t->ctx);
+  w->cur = 0;
+
+  if(!t->done){
+    // yielded: let everything else go first.
+    pushtop(w, t);
+    return;
+  }
+  *(char**)t->stack = w->stacks;
+  w->stacks = t->stack;
+  lockedfree(t);
+  w->nrun++;
+  if(__sync_sub_and_fetch(&ntask, 1) == 0){
+    __sync_fetch_and_add(&workseq, 1);
+    futex_wake(&workseq, NWORKER);
+  }
+}
+
+// Each worker's scheduler loop. Returns when all tasks are done.
+static void
+schedule(struct worker *w)
+{
+  struct task *t;
+  uint seq;
+
+  for(;;){
+    seq = workseq;
+    if((t = popbottom(w)) == 0 && (t = steal(w)) == 0){
+      if(ntask == 0)
+        return;
+      // a spawn or the last task finishing after seq was
+      // read changes workseq, so futex_wait() returns.
+      __sync_fetch_and_add(&nidle, 1);
+      futex_wait(&workseq, seq);
+      __sync_fetch_and_sub(&nidle, 1);
+      continue;
+    }
+    run(w, t);
+  }
+}
+
+static void
+workermain(void *arg)
+{
+  struct worker *w = arg;
+
+  asm volatile("mv tp, %0" : : "r" (w));
+  schedule(w);
+}
+
+// Create a task running fn(arg), to be run by this
+// worker unless another one steals it first.
+void
+task_spawn(void (*fn)(void*), void *arg)
+{
+  struct task *t;
+
+  if((t = lockedmalloc(sizeof(*t))) == 0){
+    printf("task: out of memory\n");
+    exit(1);
+  }
+  t->fn = fn;
+  t->arg = arg;
+  t->stack = 0;
+  t->done = 0;
+  __sync_fetch_and_add(&ntask, 1);
+  pushbottom(me(), t);
+  __sync_fetch_and_add(&workseq, 1);
+  if(nidle > 0)
+    futex_wake(&workseq, 1);
+}
+
+// Let other tasks run before continuing.
+void
+task_yield(void)
+{
+  struct worker *w = me();
+
+  uswtch(&w->cur->ctx, &w->sched);
+}
+
+// Run fn(arg) as a task on n workers, and return once it
+// and every task spawned from it have finished.
+// Returns -1 if the workers could not be started.
+int
+task_run(int n, void (*fn)(void*), void *arg)
+{
+  int tids[NWORKER];
+  char *s;
+  int i;
+
+  if(n < 1 || n > NWORKER)
+    return -1;
+  memset(workers, 0, sizeof(workers));
+  nworker = n;
+  mutex_init(&allocmu);
+  asm volatile("mv tp, %0" : : "r" (&workers[0]));
+  task_spawn(fn, arg);
+
+  // thread_create() calls malloc(), so keep the
+  // workers out of it until they have all started.
+  mutex_lock(&allocmu);
+  for(i = 1; i < n; i++){
+    if((tids[i] = thread_create(workermain, &workers[i])) < 0){
+      printf("task: cannot start worker\n");
+      exit(1);
+    }
+  }
+  mutex_unlock(&allocmu);
+  schedule(&workers[0]);
+  for(i = 1; i < n; i++)
+    thread_join(tids[i]);
+
+  for(i = 0; i < n; i++){
+    while((s = workers[i].stacks) != 0){
+      workers[i].stacks = *(char**)s;
+      free(s);
+    }
+  }
+  return 0;
+}
+
+// Totals for the last task_run().
+void
+task_stats(uint64 *nrun, uint64 *nsteal)
+{
+  int i;
+
+  *nrun = *nsteal = 0;
+  for(i = 0; i < nworker; i++){
+    *nrun += workers[i].nrun;
+    *nsteal += workers[i].nsteal;
+  }
+}
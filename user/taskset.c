@@ -0,0 +1,71 @@
+// Run a command, or change a running process,
+// restricted to a set of CPUs.
+//   taskset mask command [arg ...]
+//   taskset -p mask pid
+//   taskset -p pid
+// mask is in hex: bit i allows CPU i.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+uint64
+hex(char *s)
+{
+  uint64 n = 0;
+
+  if(s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+    s += 2;
+  for(; *s; s++){
+    if(*s >= '0' && *s <= '9')
+      n = n*16 + *s - '0';
+    else if(*s >= 'a' && *s <= 'f')
+      n = n*16 + *s - 'a' + 10;
+    else if(*s >= 'A' && *s <= 'F')
+      n = n*16 + *s - 'A' + 10;
+    else
+      break;
+  }
+  return n;
+}
+
+void
+usage(void)
+{
+  fprintf(2, "usage: taskset mask command [arg ...]\n"
+             "       taskset -p [mask] pid\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int pid;
+
+  if(argc < 3)
+    usage();
+
+  if(strcmp(argv[1], "-p") == 0){
+    if(argc == 3){
+      pid = atoi(argv[2]);
+      printf("pid %d: mask %x\n", pid, (int)getaffinity(pid));
+      exit(0);
+    }
+    if(argc != 4)
+      usage();
+    pid = atoi(argv[3]);
+    if(setaffinity(pid, hex(argv[2])) < 0){
+      fprintf(2, "taskset: cannot set mask of pid %d\n", pid);
+      exit(1);
+    }
+    exit(0);
+  }
+
+  if(setaffinity(0, hex(argv[1])) < 0){
+    fprintf(2, "taskset: bad mask %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "taskset: exec %s failed\n", argv[2]);
+  exit(1);
+}
@@ -0,0 +1,144 @@
+// User-level threads, on top of clone() and join(),
+// and mutexes and condition variables, on top of futexes.
+// Threads share memory but get their own stack,
+// allocated with malloc(), which is not thread-safe:
+// create and join threads from one thread only.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define TSTACK 4096   // bytes of stack per thread
+#define NTHR   64
+
+struct tstart {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static struct {
+  int tid;
+  char *stack;
+} threads[NTHR];
+
+static void
+threadstart(void *a)
+{
+  struct tstart *s = a;
+
+  s->fn(s->arg);
+  exit(0);
+}
+
+// Start a thread running fn(arg).
+// Returns its thread id, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  struct tstart *s;
+  char *stack;
+  int i, tid;
+
+  for(i = 0; i < NTHR; i++)
+    if(threads[i].stack == 0)
+      break;
+  if(i == NTHR || (stack = malloc(TSTACK)) == 0)
+    return -1;
+
+  // pass fn and arg at the top of the new stack.
+  s = (struct tstart*)(stack + TSTACK) - 1;
+  s->fn = fn;
+  s->arg = arg;
+  if((tid = clone(threadstart, s, s)) < 0){
+    free(stack);
+    return -1;
+  }
+  threads[i].tid = tid;
+  threads[i].stack = stack;
+  return tid;
+}
+
+// Wait for thread tid, or any thread if tid is 0,
+// to exit, and free its stack.
+// Returns the thread id, or -1.
+int
+thread_join(int tid)
+{
+  int i;
+
+  if((tid = join(tid, 0)) < 0)
+    return -1;
+  for(i = 0; i < NTHR; i++){
+    if(threads[i].stack && threads[i].tid == tid){
+      free(threads[i].stack);
+      threads[i].stack = 0;
+    }
+  }
+  return tid;
+}
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+// Take the lock without entering the kernel unless
+// it is held; sleep on the futex while it stays held.
+void
+mutex_lock(struct mutex *m)
+{
+  uint c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  // mark the lock contended, so that the holder's
+  // unlock knows to wake someone.
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    __sync_lock_release(&m->state);
+    futex_wake(&m->state, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Release m, sleep until signalled, and re-acquire m.
+// As with any condition variable, wakeups can be spurious.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  uint seq;
+
+  seq = c->seq;
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 0x7fffffff);
+}
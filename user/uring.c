@@ -0,0 +1,38 @@
+// Helpers for the uring_enter() submission and completion rings.
+
+#include "kernel/types.h"
+#include "kernel/uring.h"
+#include "user/user.h"
+
+// Queue a request on r's submission ring.
+// Returns -1 if the ring is full.
+int
+uring_post(struct uring *r, int op, int fd, void *addr, int n, uint64 data)
+{
+  struct sqe *e;
+
+  if(r->sqtail - r->sqhead == URING_SIZE)
+    return -1;
+  e = &r->sq[r->sqtail % URING_SIZE];
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->n = n;
+  e->data = data;
+  __sync_synchronize();
+  r->sqtail++;
+  return 0;
+}
+
+// Take the oldest completion off r's completion ring.
+// Returns 0 if there is none.
+int
+uring_reap(struct uring *r, struct cqe *c)
+{
+  if(r->cqhead == r->cqtail)
+    return 0;
+  __sync_synchronize();
+  *c = r->cq[r->cqhead % URING_SIZE];
+  r->cqhead++;
+  return 1;
+}
@@ -1,5 +1,10 @@
 struct stat;
 struct rtcdate;
+struct cpustat;
+struct bcachestat;
+struct uring;
+struct cqe;
+struct pollfd;
 
 // system calls
 int fork(void);
@@ -23,6 +28,21 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int nsleep(uint64);
+uint64 uptimens(void);
+int cpustat(int, struct cpustat*);
+int clone(void(*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(volatile uint*, uint);
+int futex_wake(volatile uint*, int);
+int setaffinity(int, uint64);
+uint64 getaffinity(int);
+int uring_enter(struct uring*);
+int poll(struct pollfd*, int, int);
+int fcntl(int, int, int);
+int splice(int, int, int);
+int fsync(int);
+int bcachestat(struct bcachestat*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,3 +60,30 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+
+// thread.c
+struct mutex {
+  volatile uint state;  // 0 free, 1 locked, 2 locked with waiters
+};
+struct cond {
+  volatile uint seq;    // bumped by every signal
+};
+int thread_create(void (*)(void*), void*);
+int thread_join(int);
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+
+// task.c
+int task_run(int, void (*)(void*), void*);
+void task_spawn(void (*)(void*), void*);
+void task_yield(void);
+void task_stats(uint64*, uint64*);
+
+// uring.c
+int uring_post(struct uring*, int, int, void*, int, uint64);
+int uring_reap(struct uring*, struct cqe*);
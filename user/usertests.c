@@ -7,6 +7,10 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/lockstat.h"
+#include "kernel/uring.h"
+#include "kernel/poll.h"
+#include "kernel/bcachestat.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -1913,12 +1917,12 @@ iref(char *s)
 }
 
 // test that fork fails gracefully
-// the forktest binary also does this, but it runs out of proc entries first.
-// inside the bigger usertests binary, we run out of memory first.
+// the forktest binary also does this, with a much smaller image per child.
+// there is no limit on processes, so both run out of memory.
 void
 forktest(char *s)
 {
-  enum{ N = 1000 };
+  enum{ N = 100000 };
   int n, pid;
 
   for(n=0; n<N; n++){
@@ -1935,7 +1939,7 @@ forktest(char *s)
   }
 
   if(n == N){
-    printf("%s: fork claimed to work 1000 times!\n", s);
+    printf("%s: fork claimed to work %d times!\n", s, N);
     exit(1);
   }
 
@@ -2527,6 +2531,1119 @@ execout(char *s)
 }
 
 //
+#define NCLONE 4
+volatile uint64 clonesum[NCLONE];
+
+void
+clonework(void *arg)
+{
+  int i, id = (uint64)arg;
+
+  for(i = 0; i < 100000; i++)
+    clonesum[id]++;
+  exit(0);
+}
+
+// threads made by clone() share memory, and are
+// reaped by join() but not by wait().
+void
+clonetest(char *s)
+{
+  char *stack;
+  int tids[NCLONE];
+  int i, j, tid, xstatus;
+
+  for(i = 0; i < NCLONE; i++){
+    if((stack = malloc(4096)) == 0){
+      printf("%s: malloc failed\n", s);
+      exit(1);
+    }
+    tids[i] = clone(clonework, (void*)(uint64)i, stack + 4096);
+    if(tids[i] < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+
+  if(wait((int*)0) != -1){
+    printf("%s: wait() reaped a thread\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < NCLONE; i++){
+    tid = join(0, &xstatus);
+    for(j = 0; j < NCLONE; j++)
+      if(tids[j] == tid)
+        break;
+    if(j == NCLONE || xstatus != 0){
+      printf("%s: join returned %d status %d\n", s, tid, xstatus);
+      exit(1);
+    }
+    tids[j] = -1;
+  }
+  if(join(0, 0) != -1){
+    printf("%s: join with no threads left\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < NCLONE; i++){
+    if(clonesum[i] != 100000){
+      printf("%s: thread %d counted %l\n", s, i, clonesum[i]);
+      exit(1);
+    }
+  }
+}
+
+volatile char *clonebuf;
+volatile int clonedone;
+
+void
+clonetouch(void *arg)
+{
+  while(!clonedone){
+    if(clonebuf){
+      if(*clonebuf != 'x')
+        exit(1);
+      *clonebuf = 'y';
+      clonebuf = 0;
+    }
+  }
+  exit(0);
+}
+
+// a thread sees memory that another thread sbrk()s, and
+// shrinking the address space under a running thread works.
+void
+clonesbrk(char *s)
+{
+  char *a, *stack;
+  int i, tid, xstatus;
+
+  if((stack = malloc(4096)) == 0){
+    printf("%s: malloc failed\n", s);
+    exit(1);
+  }
+  if((tid = clone(clonetouch, 0, stack + 4096)) < 0){
+    printf("%s: clone failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 10; i++){
+    a = sbrk(8*PGSIZE);
+    if(a == (char*)0xffffffffffffffffL){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    a[7*PGSIZE] = 'x';
+    clonebuf = a + 7*PGSIZE;
+    while(clonebuf)
+      ;
+    if(a[7*PGSIZE] != 'y'){
+      printf("%s: thread did not see new memory\n", s);
+      exit(1);
+    }
+    sbrk(-8*PGSIZE);
+  }
+  clonedone = 1;
+  if(join(tid, &xstatus) != tid || xstatus != 0){
+    printf("%s: thread failed\n", s);
+    exit(1);
+  }
+}
+
+struct mutex futexmu;
+volatile int futexcount;
+
+void
+futexincr(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 10000; i++){
+    mutex_lock(&futexmu);
+    futexcount++;
+    mutex_unlock(&futexmu);
+  }
+}
+
+// futex_wait() checks the word, and a futex mutex
+// keeps threads' increments from getting lost.
+void
+futextest(char *s)
+{
+  volatile uint word = 1;
+  int tids[NCLONE];
+  int i;
+
+  if(futex_wait(&word, 0) != -1){
+    printf("%s: futex_wait slept on a changed word\n", s);
+    exit(1);
+  }
+  if(futex_wake(&word, 1) != 0){
+    printf("%s: futex_wake woke a waiter\n", s);
+    exit(1);
+  }
+
+  mutex_init(&futexmu);
+  for(i = 0; i < NCLONE; i++){
+    if((tids[i] = thread_create(futexincr, 0)) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NCLONE; i++)
+    thread_join(tids[i]);
+  if(futexcount != NCLONE * 10000){
+    printf("%s: count %d, expected %d\n", s, futexcount, NCLONE * 10000);
+    exit(1);
+  }
+}
+
+// a CPU mask is kept, checked, and inherited by fork().
+void
+affinitytest(char *s)
+{
+  int pid, xstatus;
+
+  if(setaffinity(0, 0) != -1){
+    printf("%s: empty mask accepted\n", s);
+    exit(1);
+  }
+  if(setaffinity(0, 1) < 0 || getaffinity(0) != 1){
+    printf("%s: cannot pin to cpu 0\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(getaffinity(0) == 1 ? 0 : 1);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child did not inherit mask\n", s);
+    exit(1);
+  }
+  if(getaffinity(pid) != 0){
+    printf("%s: mask of a reaped process\n", s);
+    exit(1);
+  }
+}
+
+// concurrent readers of one file, each through its own
+// descriptor and all through a shared one.
+void
+concread(char *s)
+{
+  enum { NCHILD = 4, NBLK = 8, NREAD = 20 };
+  char buf[BSIZE];
+  int fd, sfd, i, j, k, n, pid, xstatus, total;
+  int pfd[2];
+
+  unlink("concread");
+  fd = open("concread", O_CREATE | O_WRONLY);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NBLK; i++){
+    memset(buf, 'a' + i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  sfd = open("concread", O_RDONLY);
+  if(sfd < 0 || pipe(pfd) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(k = 0; k < NCHILD; k++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = 0; j < NREAD; j++){
+        fd = open("concread", O_RDONLY);
+        for(i = 0; i < NBLK; i++){
+          if(read(fd, buf, sizeof(buf)) != sizeof(buf) ||
+             buf[0] != 'a' + i || buf[BSIZE-1] != 'a' + i){
+            printf("%s: bad data\n", s);
+            exit(1);
+          }
+        }
+        close(fd);
+      }
+      // the shared offset hands each block to just one reader.
+      total = 0;
+      while((n = read(sfd, buf, sizeof(buf))) > 0)
+        total += n;
+      write(pfd[1], &total, sizeof(total));
+      exit(0);
+    }
+  }
+  close(pfd[1]);
+  n = 0;
+  for(k = 0; k < NCHILD; k++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+    if(read(pfd[0], &total, sizeof(total)) != sizeof(total)){
+      printf("%s: pipe read failed\n", s);
+      exit(1);
+    }
+    n += total;
+  }
+  if(n != NBLK * BSIZE){
+    printf("%s: shared descriptor read %d bytes\n", s, n);
+    exit(1);
+  }
+  close(sfd);
+  close(pfd[0]);
+  unlink("concread");
+}
+
+// batched system calls through uring_enter().
+void
+uringtest(char *s)
+{
+  static struct uring r;
+  struct stat st;
+  struct cqe c;
+  char buf[16];
+  int fd, i, res[4];
+
+  unlink("uringfile");
+  uring_post(&r, URING_OPEN, 0, "uringfile", O_CREATE | O_RDWR, 0);
+  if(uring_enter(&r) != 1 || !uring_reap(&r, &c) || c.data != 0 || c.res < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  fd = c.res;
+  uring_post(&r, URING_WRITE, fd, "hello", 5, 0);
+  uring_post(&r, URING_FSTAT, fd, &st, 0, 1);
+  uring_post(&r, URING_CLOSE, fd, 0, 0, 2);
+  uring_post(&r, URING_READ, fd, buf, sizeof(buf), 3);
+  if(uring_enter(&r) != 4){
+    printf("%s: enter did not run the batch\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 4; i++){
+    if(!uring_reap(&r, &c) || c.data != i){
+      printf("%s: missing completion %d\n", s, i);
+      exit(1);
+    }
+    res[i] = c.res;
+  }
+  if(uring_reap(&r, &c)){
+    printf("%s: extra completion\n", s);
+    exit(1);
+  }
+  if(res[0] != 5 || res[1] != 0 || st.size != 5 || res[2] != 0 || res[3] != -1){
+    printf("%s: bad results %d %d %d %d\n", s, res[0], res[1], res[2], res[3]);
+    exit(1);
+  }
+
+  if((fd = open("uringfile", O_RDONLY)) < 0){
+    printf("%s: reopen failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < URING_SIZE; i++)
+    uring_post(&r, URING_READ, fd, buf, 1, i);
+  if(uring_post(&r, URING_READ, fd, buf, 1, i) != -1){
+    printf("%s: posted to a full ring\n", s);
+    exit(1);
+  }
+  if(uring_enter(&r) != URING_SIZE || uring_enter(&r) != 0){
+    printf("%s: enter ran the wrong number\n", s);
+    exit(1);
+  }
+  for(i = 0; uring_reap(&r, &c); i++){
+    if(c.res != (i < 5 ? 1 : 0)){
+      printf("%s: read %d returned %d\n", s, i, c.res);
+      exit(1);
+    }
+  }
+  if(i != URING_SIZE){
+    printf("%s: reaped %d\n", s, i);
+    exit(1);
+  }
+  close(fd);
+  unlink("uringfile");
+}
+
+// wait on several pipes at once with poll().
+void
+polltest(char *s)
+{
+  struct pollfd fds[4];
+  int a[2], b[2], pid, xstatus, t0;
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  fds[0].fd = a[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = b[0];
+  fds[1].events = POLLIN;
+  fds[2].fd = b[1];
+  fds[2].events = POLLOUT;
+  fds[3].fd = -1;
+  fds[3].events = POLLIN;
+  if(poll(fds, 2, 0) != 0 || fds[0].revents || fds[1].revents){
+    printf("%s: empty pipes ready\n", s);
+    exit(1);
+  }
+  if(poll(fds, 4, 0) != 1 || fds[2].revents != POLLOUT || fds[3].revents){
+    printf("%s: write end not ready\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(2);
+    write(b[1], "x", 1);
+    exit(0);
+  }
+  if(poll(fds, 2, -1) != 1 || fds[0].revents || fds[1].revents != POLLIN){
+    printf("%s: poll missed the write\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+
+  close(b[1]);
+  if(poll(fds, 2, -1) != 1 || (fds[1].revents & POLLHUP) == 0){
+    printf("%s: no hangup\n", s);
+    exit(1);
+  }
+  close(b[0]);
+  if(poll(fds, 2, 0) != 1 || fds[1].revents != POLLNVAL){
+    printf("%s: closed fd not invalid\n", s);
+    exit(1);
+  }
+
+  t0 = uptime();
+  if(poll(fds, 1, 500) != 0 || fds[0].revents){
+    printf("%s: timed poll returned early\n", s);
+    exit(1);
+  }
+  if(uptime() - t0 < 4){
+    printf("%s: timed poll did not wait\n", s);
+    exit(1);
+  }
+  close(a[0]);
+  close(a[1]);
+}
+
+// grow a pipe's buffer with fcntl(), fill it without
+// blocking, and check it cannot shrink below its contents.
+void
+pipesize(char *s)
+{
+  static char buf[4*PGSIZE];
+  struct pollfd pfd;
+  int fds[2], i, n;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_GETPIPESZ, 0) != PGSIZE){
+    printf("%s: default size %d\n", s, fcntl(fds[0], F_GETPIPESZ, 0));
+    exit(1);
+  }
+  for(i = 0; i < 100; i++)
+    buf[i] = i;
+  if(write(fds[1], buf, 100) != 100){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPESZ, 3*PGSIZE) != 4*PGSIZE ||
+     fcntl(fds[0], F_GETPIPESZ, 0) != 4*PGSIZE){
+    printf("%s: resize did not round up\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPESZ, (PIPEMAXPAGES+1)*PGSIZE) != -1){
+    printf("%s: resized beyond the limit\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = i * 7;
+  if(write(fds[1], buf, sizeof(buf) - 100) != sizeof(buf) - 100){
+    printf("%s: cannot fill the pipe\n", s);
+    exit(1);
+  }
+  pfd.fd = fds[1];
+  pfd.events = POLLOUT;
+  if(poll(&pfd, 1, 0) != 0){
+    printf("%s: full pipe is writable\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPESZ, PGSIZE) != -1){
+    printf("%s: shrank below the buffered data\n", s);
+    exit(1);
+  }
+
+  if((n = read(fds[0], buf, 100)) != 100){
+    printf("%s: read %d\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < 100; i++){
+    if(buf[i] != (char)i){
+      printf("%s: wrong data before resize\n", s);
+      exit(1);
+    }
+  }
+  for(n = 0; n < sizeof(buf) - 100; n += i){
+    if((i = read(fds[0], buf + n, sizeof(buf) - 100 - n)) <= 0){
+      printf("%s: short read\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < sizeof(buf) - 100; i++){
+    if(buf[i] != (char)(i * 7)){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(fcntl(fds[0], F_SETPIPESZ, 1) != PGSIZE){
+    printf("%s: cannot shrink empty pipe\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// move data between files and pipes with splice().
+void
+splicetest(char *s)
+{
+  static char buf[3000], got[3000];
+  int fd, out, p[2], i, n;
+
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 23;
+  unlink("splicein");
+  unlink("spliceout");
+  fd = open("splicein", O_CREATE | O_RDWR);
+  if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: cannot create splicein\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(pipe(p) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(p[1], F_SETPIPESZ, sizeof(buf)) < 0){
+    printf("%s: cannot resize pipe\n", s);
+    exit(1);
+  }
+
+  // file to pipe, starting at the file's offset.
+  fd = open("splicein", O_RDONLY);
+  if(read(fd, got, 10) != 10){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  if((n = splice(fd, p[1], sizeof(buf))) != sizeof(buf) - 10){
+    printf("%s: file to pipe moved %d\n", s, n);
+    exit(1);
+  }
+  if(splice(fd, p[1], 100) != 0){
+    printf("%s: no end of file\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // pipe to file.
+  out = open("spliceout", O_CREATE | O_RDWR);
+  if(write(out, buf, 10) != 10){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if((n = splice(p[0], out, sizeof(buf))) != sizeof(buf) - 10){
+    printf("%s: pipe to file moved %d\n", s, n);
+    exit(1);
+  }
+  close(out);
+  fd = open("spliceout", O_RDONLY);
+  if(read(fd, got, sizeof(got)) != sizeof(got) || memcmp(buf, got, sizeof(buf)) != 0){
+    printf("%s: wrong data through pipe\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // file to file.
+  fd = open("splicein", O_RDONLY);
+  out = open("spliceout", O_RDWR | O_TRUNC);
+  if((n = splice(fd, out, 100000)) != sizeof(buf)){
+    printf("%s: file to file moved %d\n", s, n);
+    exit(1);
+  }
+  close(fd);
+  close(out);
+  fd = open("spliceout", O_RDONLY);
+  if(read(fd, got, sizeof(got)) != sizeof(got) || memcmp(buf, got, sizeof(buf)) != 0 ||
+     read(fd, got, 1) != 0){
+    printf("%s: wrong data after file copy\n", s);
+    exit(1);
+  }
+
+  // pipe to pipe is not supported; an empty pipe
+  // with no writer is at end of file.
+  if(splice(p[0], p[1], 1) != -1 || splice(fd, 0, 1) != -1){
+    printf("%s: spliced to a pipe from a pipe or the console\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(p[1]);
+  if(splice(p[0], out = open("spliceout", O_WRONLY), 10) != 0){
+    printf("%s: no end of file on pipe\n", s);
+    exit(1);
+  }
+  close(out);
+  close(p[0]);
+  unlink("splicein");
+  unlink("spliceout");
+}
+
+// hold open more distinct inodes than NINODE at once,
+// which the inode cache must grow to hold.
+void
+icachegrow(char *s)
+{
+  enum { NCHILD = 5, NPER = NOFILE - 4 };
+  char name[8];
+  int i, j, fd, ready[2], done[2], xstatus;
+
+  if(pipe(ready) < 0 || pipe(done) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  name[0] = 'i';
+  name[1] = 'g';
+  name[4] = 0;
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(ready[0]);
+      close(done[1]);
+      for(j = 0; j < NPER; j++){
+        name[2] = '0' + i;
+        name[3] = 'a' + j;
+        if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+          printf("%s: open %s failed\n", s, name);
+          write(ready[1], "f", 1);
+          exit(1);
+        }
+      }
+      write(ready[1], "x", 1);
+      // keep them open until everyone has theirs.
+      read(done[0], name, 1);
+      exit(0);
+    }
+  }
+  close(ready[1]);
+  close(done[0]);
+  for(i = 0; i < NCHILD; i++){
+    if(read(ready[0], name, 1) != 1 || name[0] != 'x'){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+  }
+  close(done[1]);
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  close(ready[0]);
+
+  name[0] = 'i';
+  name[1] = 'g';
+  name[4] = 0;
+  for(i = 0; i < NCHILD; i++){
+    for(j = 0; j < NPER; j++){
+      name[2] = '0' + i;
+      name[3] = 'a' + j;
+      if(unlink(name) < 0){
+        printf("%s: unlink %s failed\n", s, name);
+        exit(1);
+      }
+    }
+  }
+}
+
+// lookups must see names come and go, whether the
+// dentry cache knew them as present or absent.
+void
+dcachetest(char *s)
+{
+  struct stat st1, st2;
+  int fd, i;
+
+  unlink("dcachef");
+  unlink("dcacheg");
+  for(i = 0; i < 2; i++){
+    if(open("dcachef", O_RDONLY) >= 0){
+      printf("%s: opened missing file\n", s);
+      exit(1);
+    }
+  }
+  if((fd = open("dcachef", O_CREATE | O_RDWR)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("dcachef", O_RDONLY)) < 0){
+    printf("%s: created file missing\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(open("dcacheg", O_RDONLY) >= 0 || link("dcachef", "dcacheg") < 0 ||
+     stat("dcachef", &st1) < 0 || stat("dcacheg", &st2) < 0 || st1.ino != st2.ino){
+    printf("%s: link not seen\n", s);
+    exit(1);
+  }
+  if(unlink("dcachef") < 0 || open("dcachef", O_RDONLY) >= 0 || unlink("dcachef") >= 0){
+    printf("%s: unlinked file still there\n", s);
+    exit(1);
+  }
+  if(unlink("dcacheg") < 0 || stat("dcacheg", &st2) >= 0){
+    printf("%s: unlinked link still there\n", s);
+    exit(1);
+  }
+
+  // a directory's inode may be reused by another directory
+  // elsewhere, whose ".." must not be the old one's.
+  if(mkdir("dcached") < 0 || mkdir("dcached/a") < 0 || stat("dcached/a/..", &st1) < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  if(unlink("dcached/a") < 0 || mkdir("dcachee") < 0 || mkdir("dcachee/b") < 0){
+    printf("%s: rmdir failed\n", s);
+    exit(1);
+  }
+  if(stat("dcachee/b/..", &st2) < 0 || stat("dcachee", &st1) < 0 || st1.ino != st2.ino){
+    printf("%s: stale .. after inode reuse\n", s);
+    exit(1);
+  }
+  unlink("dcachee/b");
+  unlink("dcachee");
+  unlink("dcached");
+}
+
+// grow a new directory past one block, so that it becomes
+// indexed, and check that names stay findable and that
+// reading it shows exactly the names in it.
+void
+indexdir(char *s)
+{
+  enum { N = 300 };
+  struct dirent de;
+  struct stat st;
+  char name[8];
+  int i, fd, n;
+
+  unlink("ixd/f");
+  unlink("ixd");
+  if(mkdir("ixd") < 0 || (fd = open("ixd/f", O_CREATE | O_RDWR)) < 0){
+    printf("%s: cannot create ixd/f\n", s);
+    exit(1);
+  }
+  close(fd);
+  strcpy(name, "ixd/x00");
+  for(i = 0; i < N; i++){
+    name[5] = '0' + i / 20;
+    name[6] = 'a' + i % 20;
+    if(link("ixd/f", name) < 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  // unlink every third name, then put them back.
+  for(i = 0; i < N; i += 3){
+    name[5] = '0' + i / 20;
+    name[6] = 'a' + i % 20;
+    if(unlink(name) < 0 || stat(name, &st) >= 0 || link("ixd/f", name) < 0){
+      printf("%s: relink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[5] = '0' + i / 20;
+    name[6] = 'a' + i % 20;
+    if(stat(name, &st) < 0 || st.nlink != N + 1){
+      printf("%s: lost %s\n", s, name);
+      exit(1);
+    }
+  }
+  if(stat("ixd/x0", &st) >= 0 || stat("ixd/.", &st) < 0 || stat("ixd/../ixd/f", &st) < 0){
+    printf("%s: bad lookup\n", s);
+    exit(1);
+  }
+
+  if((fd = open("ixd", O_RDONLY)) < 0){
+    printf("%s: cannot open ixd\n", s);
+    exit(1);
+  }
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de))
+    if(de.inum != 0)
+      n++;
+  close(fd);
+  if(n != N + 3){
+    printf("%s: read %d names\n", s, n);
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++){
+    name[5] = '0' + i / 20;
+    name[6] = 'a' + i % 20;
+    if(unlink(name) < 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("ixd/f") < 0 || unlink("ixd") < 0){
+    printf("%s: cannot remove ixd\n", s);
+    exit(1);
+  }
+}
+
+// new inodes come from the inode bitmap at or after their
+// directory's inode block, and a freed inode is reused.
+void
+inodelocality(char *s)
+{
+  struct stat dst, st;
+  int fd, ino;
+
+  unlink("iloc/f");
+  unlink("iloc");
+  if(mkdir("iloc") < 0 || stat("iloc", &dst) < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  if((fd = open("iloc/f", O_CREATE | O_RDWR)) < 0 || fstat(fd, &st) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(st.ino / IPB < dst.ino / IPB){
+    printf("%s: inode %d allocated below its directory's block (%d)\n", s, st.ino, dst.ino);
+    exit(1);
+  }
+  ino = st.ino;
+  if(unlink("iloc/f") < 0 || (fd = open("iloc/f", O_CREATE | O_RDWR)) < 0 || fstat(fd, &st) < 0){
+    printf("%s: recreate failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(st.ino != ino){
+    printf("%s: freed inode %d not reused (got %d)\n", s, ino, st.ino);
+    exit(1);
+  }
+  unlink("iloc/f");
+  unlink("iloc");
+}
+
+// a write longer than one transaction, then odd-sized appends
+// that leave new blocks partly filled, read back intact.
+void
+orderedwrite(char *s)
+{
+  enum { N = 40*BSIZE + 333, A = 700, NA = 8 };
+  struct stat st;
+  char *p, *q;
+  int fd, i;
+
+  p = malloc(N);
+  q = malloc(N);
+  for(i = 0; i < N; i++)
+    p[i] = i % 251;
+  unlink("ordered");
+  if((fd = open("ordered", O_CREATE | O_RDWR)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(write(fd, p, N) != N){
+    printf("%s: long write failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NA; i++){
+    if(write(fd, p + i*A, A) != A){
+      printf("%s: append %d failed\n", s, i);
+      exit(1);
+    }
+  }
+  if(fstat(fd, &st) < 0 || st.size != N + NA*A){
+    printf("%s: size %d, expected %d\n", s, (int)st.size, N + NA*A);
+    exit(1);
+  }
+  close(fd);
+
+  if((fd = open("ordered", O_RDONLY)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if(read(fd, q, N) != N || memcmp(p, q, N) != 0){
+    printf("%s: long write read back wrong\n", s);
+    exit(1);
+  }
+  if(read(fd, q, N) != NA*A || memcmp(p, q, NA*A) != 0){
+    printf("%s: appends read back wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("ordered");
+  free(p);
+  free(q);
+}
+
+// fsync() a written file and a directory; pipes and
+// bad descriptors have nothing to sync.
+void
+fsynctest(char *s)
+{
+  int fd, fds[2];
+  char c;
+
+  unlink("fsyncf");
+  if((fd = open("fsyncf", O_CREATE | O_RDWR)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "x", 1) != 1 || fsync(fd) != 0){
+    printf("%s: fsync of a file failed\n", s);
+    exit(1);
+  }
+  if(fsync(fd) != 0){
+    printf("%s: second fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("fsyncf", O_RDONLY)) < 0 || read(fd, &c, 1) != 1 || c != 'x'){
+    printf("%s: read back failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("fsyncf");
+
+  if((fd = open(".", O_RDONLY)) < 0 || fsync(fd) != 0){
+    printf("%s: fsync of a directory failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(fsync(fd) != -1){
+    printf("%s: fsync of a closed fd succeeded\n", s);
+    exit(1);
+  }
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(fsync(fds[1]) != -1){
+    printf("%s: fsync of a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// the buffer cache grows past NBUF to hold a file bigger
+// than that, and then reads it back from the cache.
+void
+bcachegrow(char *s)
+{
+  enum { N = NBUF + 20 };
+  struct bcachestat st0, st1;
+  int fd, i;
+
+  unlink("bcgrow");
+  if((fd = open("bcgrow", O_CREATE | O_RDWR)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'b', BSIZE);
+  for(i = 0; i < N; i++){
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  if((fd = open("bcgrow", O_RDONLY)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  while(read(fd, buf, BSIZE) == BSIZE)
+    ;
+  close(fd);
+  if(bcachestat(&st0) < 0){
+    printf("%s: bcachestat failed\n", s);
+    exit(1);
+  }
+  if(st0.nbuf <= NBUF || st0.nbuf > st0.maxbuf){
+    printf("%s: %d buffers, min %d max %d\n", s, (int)st0.nbuf, NBUF, (int)st0.maxbuf);
+    exit(1);
+  }
+
+  if((fd = open("bcgrow", O_RDONLY)) < 0){
+    printf("%s: reopen failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(read(fd, buf, BSIZE) != BSIZE || buf[0] != 'b'){
+      printf("%s: read back failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  bcachestat(&st1);
+  if(st1.hits - st0.hits < N){
+    printf("%s: only %d hits rereading %d blocks\n", s, (int)(st1.hits - st0.hits), N);
+    exit(1);
+  }
+  unlink("bcgrow");
+}
+
+// copy the lockstat record for sleeplocks called name to st.
+int
+sleeplockstat(char *name, struct lockstat *st)
+{
+  int fd, found;
+
+  if((fd = open("/lockstat", O_RDONLY)) < 0)
+    return -1;
+  found = 0;
+  while(!found && read(fd, st, sizeof(*st)) == sizeof(*st))
+    found = st->type == LS_SLEEP && strcmp(st->name, name) == 0;
+  close(fd);
+  return found ? 0 : -1;
+}
+
+// two processes on different harts read one block over and
+// over, so each often finds the other holding its buffer
+// while running, and should spin rather than sleep.
+void
+sleepspin(char *s)
+{
+  enum { NREAD = 2000 };
+  struct lockstat st0, st1;
+  char buf[BSIZE];
+  int fd, i, k, pid, xstatus;
+
+  // needs a second hart.
+  if(setaffinity(0, 2) < 0)
+    return;
+
+  fd = open("sleepspin", O_CREATE | O_TRUNC | O_WRONLY);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  memset(buf, 's', sizeof(buf));
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(sleeplockstat("buffer", &st0) < 0){
+    printf("%s: no record for buffer locks\n", s);
+    exit(1);
+  }
+  for(k = 0; k < 2; k++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      if(setaffinity(0, 1UL << k) < 0)
+        exit(1);
+      for(i = 0; i < NREAD; i++){
+        if((fd = open("sleepspin", O_RDONLY)) < 0 ||
+           read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 's'){
+          printf("%s: read failed\n", s);
+          exit(1);
+        }
+        close(fd);
+      }
+      exit(0);
+    }
+  }
+  for(k = 0; k < 2; k++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+  unlink("sleepspin");
+
+  if(sleeplockstat("buffer", &st1) < 0){
+    printf("%s: no record for buffer locks\n", s);
+    exit(1);
+  }
+  if(st1.ncontend == st0.ncontend){
+    printf("%s: buffer locks never contended\n", s);
+    exit(1);
+  }
+  if(st1.nspin == st0.nspin){
+    printf("%s: %l contended buffer acquisitions, none spun (%l slept)\n",
+           s, st1.ncontend - st0.ncontend, st1.nsleep - st0.nsleep);
+    exit(1);
+  }
+}
+
+// read the lockstat device a record at a time.
+void
+lockstattest(char *s)
+{
+  struct lockstat st;
+  int fd, n, found;
+
+  fd = open("/lockstat", O_RDONLY);
+  if(fd < 0){
+    printf("%s: cannot open /lockstat\n", s);
+    exit(1);
+  }
+  found = 0;
+  while((n = read(fd, &st, sizeof(st))) == sizeof(st)){
+    if(strcmp(st.name, "proc") == 0 && st.type == LS_SPIN &&
+       st.nacquire > 0 && st.ncontend <= st.nacquire)
+      found = 1;
+  }
+  if(n != 0){
+    printf("%s: read returned %d at end\n", s, n);
+    exit(1);
+  }
+  if(!found){
+    printf("%s: no record for proc locks\n", s);
+    exit(1);
+  }
+  if(write(fd, &st, sizeof(st)) != -1){
+    printf("%s: write to lockstat succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
 // use sbrk() to count how many free physical memory pages there are.
 // touches the pages to force allocation.
 // because out of memory with lazy allocation results in the process
@@ -2693,6 +3810,24 @@ main(int argc, char *argv[])
     {dirfile, "dirfile"},
     {iref, "iref"},
     {forktest, "forktest"},
+    {clonetest, "clonetest"},
+    {clonesbrk, "clonesbrk"},
+    {futextest, "futextest"},
+    {affinitytest, "affinitytest"},
+    {lockstattest, "lockstattest"},
+    {concread, "concread"},
+    {uringtest, "uringtest"},
+    {polltest, "polltest"},
+    {pipesize, "pipesize"},
+    {splicetest, "splicetest"},
+    {icachegrow, "icachegrow"},
+    {dcachetest, "dcachetest"},
+    {indexdir, "indexdir"},
+    {inodelocality, "inodelocality"},
+    {orderedwrite, "orderedwrite"},
+    {fsynctest, "fsynctest"},
+    {bcachegrow, "bcachegrow"},
+    {sleepspin, "sleepspin"},
     {bigdir, "bigdir"}, // slow
     { 0, 0},
   };
@@ -36,3 +36,18 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("nsleep");
+entry("uptimens");
+entry("cpustat");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("setaffinity");
+entry("getaffinity");
+entry("uring_enter");
+entry("poll");
+entry("fcntl");
+entry("splice");
+entry("fsync");
+entry("bcachestat");
@@ -1,30 +1,68 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/uring.h"
 #include "user/user.h"
 
-char buf[512];
+#define NBATCH 8
+
+char bufs[NBATCH][512];
+struct uring ring;
+
+// Fill the buffers with one read each and return the number of
+// buffers read, with their lengths in len. A regular file is read
+// with a single uring_enter(); anything else, such as a pipe or the
+// console, gets one read() so that wc does not wait for more input
+// than it needs.
+int
+fill(int fd, int regular, int *len)
+{
+  struct cqe c;
+  int i;
+
+  if(!regular){
+    len[0] = read(fd, bufs[0], sizeof(bufs[0]));
+    return 1;
+  }
+  for(i = 0; i < NBATCH; i++)
+    uring_post(&ring, URING_READ, fd, bufs[i], sizeof(bufs[i]), i);
+  uring_enter(&ring);
+  for(i = 0; i < NBATCH; i++)
+    len[i] = -1;
+  while(uring_reap(&ring, &c))
+    len[c.data] = c.res;
+  return NBATCH;
+}
 
 void
 wc(int fd, char *name)
 {
-  int i, n;
+  int i, j, n, nbuf, regular;
   int l, w, c, inword;
+  int len[NBATCH];
+  struct stat st;
+  char *buf;
 
+  regular = fstat(fd, &st) == 0 && st.type == T_FILE;
   l = w = c = 0;
   inword = 0;
-  while((n = read(fd, buf, sizeof(buf))) > 0){
-    for(i=0; i<n; i++){
-      c++;
-      if(buf[i] == '\n')
-        l++;
-      if(strchr(" \r\t\n\v", buf[i]))
-        inword = 0;
-      else if(!inword){
-        w++;
-        inword = 1;
+  n = 0;
+  do {
+    nbuf = fill(fd, regular, len);
+    for(j = 0; j < nbuf && (n = len[j]) > 0; j++){
+      buf = bufs[j];
+      for(i=0; i<n; i++){
+        c++;
+        if(buf[i] == '\n')
+          l++;
+        if(strchr(" \r\t\n\v", buf[i]))
+          inword = 0;
+        else if(!inword){
+          w++;
+          inword = 1;
+        }
       }
     }
-  }
+  } while(n > 0);
   if(n < 0){
     printf("wc: read error\n");
     exit(1);
@@ -0,0 +1,88 @@
+// Measure how long each write() to a file takes, and print
+// latency percentiles in microseconds. With -s, fsync() the
+// file after every write and time the two together.
+//   writelat [-s] [n [size]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define MAXN     1000
+#define MAXBYTES (200*1024)  // keep the file well under MAXFILE
+
+uint64 lat[MAXN];
+char buf[4096];
+
+void
+sort(uint64 *a, int n)
+{
+  int i, j;
+  uint64 x;
+
+  for(i = 1; i < n; i++){
+    x = a[i];
+    for(j = i; j > 0 && a[j-1] > x; j--)
+      a[j] = a[j-1];
+    a[j] = x;
+  }
+}
+
+void
+report(char *what, int pct, int n)
+{
+  int i = (n * pct + 99) / 100 - 1;
+
+  if(i < 0)
+    i = 0;
+  printf("%s\t%l\n", what, lat[i] / 1000);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, size, sync, fd;
+  uint64 t0;
+
+  sync = 0;
+  if(argc > 1 && strcmp(argv[1], "-s") == 0){
+    sync = 1;
+    argc--;
+    argv++;
+  }
+  n = argc > 1 ? atoi(argv[1]) : 400;
+  size = argc > 2 ? atoi(argv[2]) : 512;
+  if(size < 1 || size > sizeof(buf))
+    size = 512;
+  if(n > MAXN)
+    n = MAXN;
+  if(n > MAXBYTES / size)
+    n = MAXBYTES / size;
+  if(n < 1)
+    n = 1;
+  memset(buf, 'w', size);
+
+  if((fd = open("/wlat", O_CREATE | O_TRUNC | O_WRONLY)) < 0){
+    printf("writelat: cannot create /wlat\n");
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    t0 = uptimens();
+    if(write(fd, buf, size) != size || (sync && fsync(fd) < 0)){
+      printf("writelat: write %d failed\n", i);
+      exit(1);
+    }
+    lat[i] = uptimens() - t0;
+  }
+  close(fd);
+  unlink("/wlat");
+
+  sort(lat, n);
+  printf("%d writes of %d bytes%s\n", n, size, sync ? " + fsync" : "");
+  printf("pct\tusec\n");
+  report("p50", 50, n);
+  report("p90", 90, n);
+  report("p99", 99, n);
+  report("max", 100, n);
+  exit(0);
+}